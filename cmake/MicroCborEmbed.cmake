@@ -0,0 +1,59 @@
+# Embed JSON or CBOR data files as read-only CBOR with a perfect hash index.
+#
+#   include(cmake/MicroCborEmbed.cmake)
+#   microcbor_embed(<target> INPUT <file.json|file.cbor> NAME <name>)
+#
+# Adds a generated source to <target> defining the CBOR as
+# `const uint8_t <name>[]`, aligned so typed arrays can be read in place, and
+# `const entazza::MicroCborIndex <name>Index` for constant time lookups of
+# its top-level keys.  Include "<name>.h" to use them.
+#
+# The MicroCborEmbed tool runs on the build host and is only built when
+# microcbor_embed() is first used.  When cross compiling, set
+# MICROCBOR_EMBED_EXECUTABLE to a host build of the tool, or define an
+# imported MicroCborEmbed executable target before the first call.
+
+get_filename_component(MICROCBOR_ROOT_DIR ${CMAKE_CURRENT_LIST_DIR}/.. ABSOLUTE)
+set(MICROCBOR_ROOT_DIR ${MICROCBOR_ROOT_DIR} CACHE INTERNAL "")
+set(MICROCBOR_EMBED_EXECUTABLE "" CACHE FILEPATH
+    "MicroCborEmbed built for the host, used instead of building it")
+
+function(microcbor_embed TARGET)
+  cmake_parse_arguments(EMBED "" "INPUT;NAME" "" ${ARGN})
+  if(NOT EMBED_INPUT OR NOT EMBED_NAME)
+    message(FATAL_ERROR "microcbor_embed: INPUT and NAME are required")
+  endif()
+  if(MICROCBOR_EMBED_EXECUTABLE)
+    set(tool ${MICROCBOR_EMBED_EXECUTABLE})
+  else()
+    if(NOT TARGET MicroCborEmbed)
+      if(CMAKE_CROSSCOMPILING)
+        message(FATAL_ERROR "microcbor_embed: set MICROCBOR_EMBED_EXECUTABLE "
+                            "to a MicroCborEmbed built for the host")
+      endif()
+      add_executable(MicroCborEmbed EXCLUDE_FROM_ALL
+                     ${MICROCBOR_ROOT_DIR}/tools/MicroCborEmbed.cpp)
+      target_include_directories(MicroCborEmbed PRIVATE
+                                 ${MICROCBOR_ROOT_DIR}/include)
+      target_compile_definitions(MicroCborEmbed PRIVATE
+                                 CONFIG_MICROCBOR_STD_VECTOR
+                                 CONFIG_MICROCBOR_MAX_NESTING=32)
+      set_target_properties(MicroCborEmbed PROPERTIES CXX_STANDARD 17)
+    endif()
+    set(tool MicroCborEmbed)
+  endif()
+  get_filename_component(input ${EMBED_INPUT} ABSOLUTE)
+  set(dir ${CMAKE_CURRENT_BINARY_DIR}/microcbor_embed)
+  set(source ${dir}/${EMBED_NAME}.cpp)
+  set(header ${dir}/${EMBED_NAME}.h)
+  add_custom_command(
+    OUTPUT ${source} ${header}
+    COMMAND ${CMAKE_COMMAND} -E make_directory ${dir}
+    COMMAND ${tool} ${input} ${source} ${header} ${EMBED_NAME}
+    DEPENDS ${tool} ${input}
+    COMMENT "Embedding ${EMBED_INPUT} as ${EMBED_NAME}"
+    VERBATIM)
+  target_sources(${TARGET} PRIVATE ${source})
+  target_include_directories(${TARGET} PRIVATE ${dir}
+                             ${MICROCBOR_ROOT_DIR}/include)
+endfunction()
@@ -37,16 +37,76 @@
 
 #include <cstdint>
 #include <cstring>      // memcpy
+#include <iterator>     // std::iterator_traits
+#include <limits>       // std::numeric_limits
 #include <type_traits>  // std::enable_if
 
 #ifdef CONFIG_MICROCBOR_STD_VECTOR
+#include <algorithm>  // std::sort
 #include <vector>
 #endif
 
+#ifdef CONFIG_MICROCBOR_STD_CHRONO
+#include <chrono>
+#endif
+
+#ifdef CONFIG_MICROCBOR_STD_CONTAINERS
+#include <array>
+#include <map>
+#include <string>
+#include <unordered_map>
+#endif
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>  // _mm_crc32_u64
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>  // __crc32cd
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>  // _mm_movemask_epi8
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>  // vmaxvq_u8
+#endif
+
+#ifdef CONFIG_MICROCBOR_THREADS
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+#endif
+
+#ifdef CONFIG_MICROCBOR_MADVISE
+#include <sys/mman.h>  // madvise
+#include <unistd.h>    // sysconf
+#endif
+
+#if __cplusplus >= 201703L
+#include <array>
+#include <optional>
+#include <variant>
+#endif
+
 #ifndef CONFIG_MICROCBOR_MAX_NESTING
 #define CONFIG_MICROCBOR_MAX_NESTING 4
 #endif
 
+#ifndef CONFIG_MICROCBOR_MAX_TENSOR_DIMS
+#define CONFIG_MICROCBOR_MAX_TENSOR_DIMS 4
+#endif
+
+#ifndef CONFIG_MICROCBOR_MAX_SCAN_DEPTH
+#define CONFIG_MICROCBOR_MAX_SCAN_DEPTH 32
+#endif
+
+// Skips of at least this many bytes prefetch the following header, 0 to
+// disable
+#ifndef CONFIG_MICROCBOR_PREFETCH_MIN
+#define CONFIG_MICROCBOR_PREFETCH_MIN 256
+#endif
+
 #ifndef MicroCborSerializer
 #define MicroCborSerializer MicroCborSerializer
 #endif
@@ -70,6 +130,10 @@ constexpr uint8_t kCborFloat32 = kCborSimple << 5 | 26;
 constexpr uint8_t kCborFloat64 = kCborSimple << 5 | 27;
 
 constexpr uint16_t kCborTagInvalid = 65535;
+constexpr uint8_t kCborTagEpochTime = 1;
+constexpr uint8_t kCborTagPositiveBignum = 2;
+constexpr uint8_t kCborTagNegativeBignum = 3;
+constexpr uint8_t kCborTagMultiDimArray = 40;
 constexpr uint8_t kCborTagHomogeneousArray = 41;
 constexpr uint8_t kCborTagUint8 = 64;
 constexpr uint8_t kCborTagUint16 = 69;
@@ -83,6 +147,61 @@ constexpr uint8_t kCborTagFloat32 = 85;
 constexpr uint8_t kCborTagFloat64 = 86;
 constexpr uint16_t kCborTagTimeExt = 1001;
 constexpr uint16_t kCborTagDurationExt = 1002;
+constexpr uint16_t kCborTagMultiDimArrayColumnMajor = 1040;
+constexpr uint16_t kCborTagSelfDescribed = 55799;
+constexpr uint16_t kCborTagVariant = 19200;    //< Unregistered, + index
+constexpr uint16_t kCborMaxVariantAlternatives = 64;
+constexpr uint16_t kCborTagKeyFilter = 19270;  //< Unregistered, "KF"
+
+// Initial byte classes, see MicroCbor::initialByte()
+constexpr uint8_t kCborClassHeaderMask = 0x0f;  //< Header bytes, 0 if invalid
+constexpr uint8_t kCborClassScalar = 0x10;      //< Integers and simple values
+constexpr uint8_t kCborClassString = 0x20;      //< Byte and text strings
+constexpr uint8_t kCborClassContainer = 0x40;   //< Arrays and maps
+constexpr uint8_t kCborClassTag = 0x80;
+
+#if defined(__GNUC__)
+#define MICROCBOR_COLD __attribute__((noinline, cold))
+#define MICROCBOR_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define MICROCBOR_COLD
+#define MICROCBOR_PREFETCH(p)
+#endif
+
+/**
+ * @brief Error codes returned by encoding methods and getResult().  Only
+ * the first failure is kept.
+ */
+enum MicroCborError : int {
+  kCborOk = 0,
+  kCborErrorBufferFull = -1,   //< The output buffer is too small
+  kCborErrorLimit = -2,        //< A MicroCborLimits value was exceeded
+  kCborErrorNesting = -3,      //< Too many nested maps or arrays
+  kCborErrorReadOnly = -4,     //< Encoding into a read-only buffer
+  kCborErrorUnsupported = -5,  //< A value or encoding that is not supported
+  kCborErrorMalformed = -6,    //< Truncated or invalid CBOR
+  kCborErrorState = -7,        //< Call not valid in the current state
+  kCborErrorNotFound = -8,     //< tryGet(): the key is not present
+  kCborErrorWrongType = -9,    //< tryGet(): the value has another type
+  kCborErrorUtf8 = -10,        //< A text string is not valid UTF-8
+};
+
+/**
+ * @brief Limits applied while decoding so untrusted input has a bounded
+ * worst case.  Exceeding a limit stops the scan and sets kCborErrorLimit.
+ */
+struct MicroCborLimits {
+  /// Nesting depth of maps and arrays, at most CONFIG_MICROCBOR_MAX_SCAN_DEPTH
+  uint8_t maxDepth = CONFIG_MICROCBOR_MAX_SCAN_DEPTH;
+  /// Items declared by all the containers within one skipped item
+  uint32_t maxItems = UINT32_MAX;
+  /// Items declared by a single map or array
+  uint32_t maxContainerItems = UINT32_MAX;
+  /// Length of a text or byte string
+  uint32_t maxStringLength = UINT32_MAX;
+  /// Items visited by all lookups since the buffer was set or restarted
+  uint32_t maxWork = UINT32_MAX;
+};
 
 /**
  * @brief Helpers to get a CBOR tag type given a template type
@@ -93,7 +212,7 @@ constexpr uint16_t kCborTagDurationExt = 1002;
  * @tparam void
  */
 template <typename T, typename Dummy = void>
-struct kCborTagInfo;
+struct kCborTagInfo {};
 template <>
 struct kCborTagInfo<int8_t> {
   constexpr static const uint8_t tag = kCborTagInt8;
@@ -135,11 +254,83 @@ struct kCborTagInfo<double> {
   constexpr static const uint8_t tag = kCborTagFloat64;
 };
 
+/**
+ * @brief Helper to check if a type can be stored in a typed array.
+ *
+ * @tparam T
+ */
+template <typename T, typename Dummy = void>
+struct kCborHasTagInfo : std::false_type {};
+template <typename T>
+struct kCborHasTagInfo<T, decltype(void(kCborTagInfo<T>::tag))>
+    : std::true_type {};
+
+/**
+ * @brief Helper to identify 128 bit integers, which are encoded as bignums
+ * when they do not fit in 64 bits.
+ *
+ * @tparam T
+ */
+template <typename T>
+struct kCborIsInt128 : std::false_type {};
+#ifdef __SIZEOF_INT128__
+template <>
+struct kCborIsInt128<__int128> : std::true_type {};
+template <>
+struct kCborIsInt128<unsigned __int128> : std::true_type {};
+#endif
+
+class MicroCbor;
+
+/**
+ * @brief Extension point to encode and decode application types.
+ *
+ * Specialize for a type to allow add(name, value) and get(name, default) to
+ * be used with it.  Dispatch happens at compile time.  The encoded item is
+ * preceded by tag, which should be a CBOR tag reserved for the application
+ * (below 65535), or kCborTagInvalid for no tag.
+ *
+ *  template <>
+ *  struct MicroCborCodec<Vec3> {
+ *    static constexpr uint16_t tag = 40001;
+ *    // Encode exactly one unnamed item
+ *    static void encode(MicroCbor &cbor, const Vec3 &v) {
+ *      cbor.add(nullptr, &v.x, 3, false);
+ *    }
+ *    // Decode from an instance positioned on the item.  Use null names to
+ *    // read the item itself.
+ *    static bool decode(MicroCbor &item, Vec3 &v) {
+ *      auto a = item.getPointerChecked<float>(nullptr, nullptr, &v.x, 3);
+ *      if (a.length != 3) return false;
+ *      memcpy(&v.x, a.p, sizeof(float) * 3);
+ *      return true;
+ *    }
+ *  };
+ *
+ * @tparam T The application type
+ * @tparam Enable Allows partial specialization with std::enable_if
+ */
+template <typename T, typename Enable = void>
+struct MicroCborCodec {};
+
+/**
+ * @brief Helper to check if a type has a MicroCborCodec specialization.
+ *
+ * @tparam T
+ */
+template <typename T, typename Dummy = void>
+struct kCborHasCodec : std::false_type {};
+template <typename T>
+struct kCborHasCodec<T, decltype(void(MicroCborCodec<T>::tag))>
+    : std::true_type {};
+
 /**
  * @brief A class to encode and decode data in CBOR format.
  */
 class MicroCbor {
   friend class MicroCborSerializer;
+  friend class MicroCborSequence;
+  friend struct MicroCborIndex;
 
  private:
   struct TypeInfo {
@@ -148,20 +339,39 @@ class MicroCbor {
     uint8_t minorval;
     uint8_t headerBytes;
     uint8_t *p;
-    TypeInfo(uint8_t majorval) : majorval(majorval) {}
+    uint8_t *start;    //< The first byte of the item including any tags
+    uint8_t *content;  //< The item following the outermost tag, or start
+    TypeInfo(uint8_t majorval)
+        : tag(kCborTagInvalid),
+          majorval(majorval),
+          minorval(0),
+          headerBytes(0),
+          p(nullptr),
+          start(nullptr),
+          content(nullptr) {}
     TypeInfo(uint16_t tag, uint8_t majorval, uint8_t minorval, uint8_t headerBytes,
              uint8_t *p)
         : tag(tag),
           majorval(majorval),
           minorval(minorval),
           headerBytes(headerBytes),
-          p(p) {}
+          p(p),
+          start(p),
+          content(p) {}
   };
 
   typedef struct {
     uint32_t mapStartPos;
     uint32_t mapStartCount;
-    uint16_t mapCount;
+    uint32_t mapCount;
+    uint32_t itemStart;  //< Offset of the last list item (homogeneous only)
+    uint32_t itemSize;   //< Size of each list item (homogeneous only)
+    uint8_t headerBytes;
+    bool isArray;
+    bool homogeneous;  //< Tagged homogeneous and all items the same size
+    uint32_t alignment;    //< Least common multiple of alignments within
+    uint32_t filterPos;    //< Offset of the key filter bits, 0 if none
+    uint32_t filterBytes;  //< Size of the key filter
   } MapState;
 
   uint8_t *mBuf;
@@ -172,8 +382,16 @@ class MicroCbor {
   Error mResult = 0;
   bool mReadOnly = false;
   bool mNullTerminate = false;  // True to null terminate user strings
+  uint32_t mAlignmentMisses = 0;  //< Arrays copied by getPointerChecked()
+  uint32_t mChecksumPos = 0;  //< Offset of the checksum slot value, 0 if none
+  bool mValidateUtf8 = false;  //< True to check strings when they are read
+  MicroCborLimits mLimits;
+  uint32_t mWork = 0;  //< Items visited, checked against mLimits.maxWork
+  uint32_t mErrorOffset = 0;  //< Buffer offset of the first failure
+  int mErrorDepth = 0;        //< Nesting depth of the first failure
+  uint32_t mAlignment = 1;    //< Least common multiple of alignments used
 
-  int8_t mDepth;  //< How deep we've nested maps
+  int8_t mDepth;  //< How deep we've nested maps and arrays
   MapState mMapState[CONFIG_MICROCBOR_MAX_NESTING];
 
   /**
@@ -187,7 +405,7 @@ class MicroCbor {
   inline void reserveBytes(const uint32_t n) noexcept {
     mBufBytesNeeded += n;
     if (mBufBytesNeeded > mMaxBufLen) {
-      mResult = -1;
+      fail(kCborErrorBufferFull);
     }
   }
 
@@ -198,35 +416,80 @@ class MicroCbor {
    * @return uint8_t The number of bytes needed
    */
   inline uint8_t bytesForLength(const uint32_t length) {
-    return (length < 24) ? 1 : (length < 256) ? 2 : (length < 0x10000) ? 3 : 4;
+    return (length < 24) ? 1 : (length < 256) ? 2 : (length < 0x10000) ? 3 : 5;
+  }
+
+  /**
+   * @brief Convert between host and big-endian (network) byte order.
+   */
+  static uint16_t bigEndian(const uint16_t v) noexcept {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return v;
+#elif defined(__GNUC__)
+    return __builtin_bswap16(v);
+#else
+    return uint16_t(v << 8 | v >> 8);
+#endif
+  }
+  static uint32_t bigEndian(const uint32_t v) noexcept {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return v;
+#elif defined(__GNUC__)
+    return __builtin_bswap32(v);
+#else
+    return v << 24 | (v & 0xff00) << 8 | (v >> 8 & 0xff00) | v >> 24;
+#endif
+  }
+  static uint64_t bigEndian(const uint64_t v) noexcept {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return v;
+#elif defined(__GNUC__)
+    return __builtin_bswap64(v);
+#else
+    return uint64_t(bigEndian(uint32_t(v))) << 32 | bigEndian(uint32_t(v >> 32));
+#endif
+  }
+
+  /**
+   * @brief Load a big-endian value from a possibly unaligned location.
+   */
+  template <typename T>
+  static T load(const uint8_t *p) noexcept {
+    T v;
+    memcpy(&v, p, sizeof(v));
+    return bigEndian(v);
+  }
+
+  /**
+   * @brief Store a value big-endian to a possibly unaligned location.
+   */
+  template <typename T>
+  static void store(uint8_t *p, const T value) noexcept {
+    const T v = bigEndian(value);
+    memcpy(p, &v, sizeof(v));
   }
 
   /**
-   * @brief Get the Length value from the current tag
+   * @brief Classify an initial byte.
    *
-   * @return uint32_t
+   * @param b The initial byte of a header
+   * @return uint8_t The number of header bytes, 0 for reserved and indefinite
+   * length minor values which are not supported, or'ed with a kCborClass*
+   * class
    */
-  uint32_t getLength() noexcept {
-    uint32_t len = mBuf[mDataOffset] & 0x1f;
-    auto p = mBuf + mDataOffset + 1;
-    if (len < 24) {
-      mDataOffset++;
-      return len;
-    }
-    if (len == 24) {
-      mDataOffset += 2;
-      return *p;
-    }
-    if (len == 25) {
-      mDataOffset += 3;
-      return p[0] << 8 | p[1];
-    }
-    if (len == 26) {
-      mDataOffset += 5;
-      return p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
-    }
-    mResult = -1;
-    return 0;  // unsupported;
+  static uint8_t initialByte(const uint8_t b) noexcept {
+#define MICROCBOR_X8(v) v, v, v, v, v, v, v, v
+#define MICROCBOR_ROW(c)                                                \
+  MICROCBOR_X8(c | 1), MICROCBOR_X8(c | 1), MICROCBOR_X8(c | 1), c | 2, \
+      c | 3, c | 5, c | 9, 0, 0, 0, 0
+    static const uint8_t kTable[256] = {
+        MICROCBOR_ROW(kCborClassScalar),    MICROCBOR_ROW(kCborClassScalar),
+        MICROCBOR_ROW(kCborClassString),    MICROCBOR_ROW(kCborClassString),
+        MICROCBOR_ROW(kCborClassContainer), MICROCBOR_ROW(kCborClassContainer),
+        MICROCBOR_ROW(kCborClassTag),       MICROCBOR_ROW(kCborClassScalar)};
+#undef MICROCBOR_ROW
+#undef MICROCBOR_X8
+    return kTable[b];
   }
 
   /**
@@ -235,49 +498,59 @@ class MicroCbor {
    * @return TypeInfo
    */
   TypeInfo getNextField() {
-    static const uint8_t kCborheaderBytes[24 + 4]{1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-                                                  1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-                                                  1, 1, 1, 1, 2, 3, 5, 9};
-
-    if (mDataOffset >= mMaxBufLen) {
-      return TypeInfo(kCborError);
-    }
-    uint8_t *p = mBuf + mDataOffset;
-    uint8_t majorval = *p >> 5;
-    uint8_t minorval = *p & 0x1f;
-    uint8_t headerBytes = kCborheaderBytes[minorval];
-    if (mDataOffset + headerBytes > mMaxBufLen) {
-      return TypeInfo(kCborError);
-    }
-    TypeInfo field = TypeInfo(kCborTagInvalid, majorval, minorval, headerBytes, p);
+    uint16_t tag = kCborTagInvalid;
+    uint8_t *start = mBuf + mDataOffset;
+    uint8_t *content = start;
+    for (;;) {
+      if (mDataOffset >= mMaxBufLen) {
+        return TypeInfo(kCborError);
+      }
+      uint8_t *p = mBuf + mDataOffset;
+      const uint8_t byteClass = initialByte(*p);
+      const uint8_t headerBytes = byteClass & kCborClassHeaderMask;
+      if (headerBytes == 0 || headerBytes > mMaxBufLen - mDataOffset) {
+        return TypeInfo(kCborError);
+      }
+      if (headerBytes == 9 &&
+          (byteClass & (kCborClassString | kCborClassContainer)) &&
+          load<uint32_t>(p + 1) != 0) {
+        // lengths and counts are 32 bit, so larger ones would be truncated
+        fail(kCborErrorUnsupported, 0);
+        return TypeInfo(kCborError);
+      }
+      TypeInfo field =
+          TypeInfo(kCborTagInvalid, *p >> 5, *p & 0x1f, headerBytes, p);
+      if (!(byteClass & kCborClassTag)) {
+        field.tag = tag;
+        field.start = start;
+        field.content = content;
+        return field;
+      }
 
-    if (majorval == kCborTag) {
-      // next field is the actual 'value'
-      auto tag = getFieldValue(field);
-      skipField(field);
-      field = getNextField();
-      field.tag = tag;
+      // next field is the actual 'value'.  The outermost tag is reported and
+      // self-described tags, which are used as padding, are ignored.
+      auto value = getFieldValue(field);
+      if (tag == kCborTagInvalid && value != kCborTagSelfDescribed) {
+        tag = value;
+        content = p + headerBytes;
+      }
+      mDataOffset += headerBytes;
     }
-    return field;
   }
   template <typename T = uint32_t>
-  inline T getFieldValue(const TypeInfo &info) {
-    uint8_t *p = info.p + 1;
+  static inline T getFieldValue(const TypeInfo &info) {
+    const uint8_t *p = info.p + 1;
     switch (info.headerBytes) {
       case 1:
         return info.minorval;
       case 2:
         return *p;
       case 3:
-        return uint16_t(p[0]) << 8 | p[1];
+        return load<uint16_t>(p);
       case 5:
-        return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 |
-               uint32_t(p[2]) << 8 | p[3];
+        return load<uint32_t>(p);
       case 9:
-        return uint64_t(p[0]) << 56 | uint64_t(p[1]) << 48 |
-               uint64_t(p[2]) << 40 | uint64_t(p[3]) << 32 |
-               uint64_t(p[4]) << 24 | uint64_t(p[5]) << 16 |
-               uint64_t(p[6]) << 8 | uint64_t(p[7]);
+        return T(load<uint64_t>(p));
       default:
         return 0;
     }
@@ -289,38 +562,174 @@ class MicroCbor {
    * @param info
    */
   void skipField(const TypeInfo &info) noexcept {
-    auto len = getFieldValue(info);
-    mDataOffset += info.headerBytes;
-    if (mDataOffset >= mMaxBufLen) {
+    if (info.majorval < kCborArray && mWork < mLimits.maxWork) {
+      // Fast path for scalars and strings, the common case in lookups
+      const uint32_t len =
+          info.majorval >= kCborByteString ? getFieldValue(info) : 0;
+      if (len <= mLimits.maxStringLength &&
+          len <= mMaxBufLen - mDataOffset - info.headerBytes) {
+        mWork++;
+        mDataOffset += info.headerBytes;
+        prefetchAfter(len);
+        mDataOffset += len;
+        return;
+      }
+    } else if (info.majorval == kCborSimple && mWork < mLimits.maxWork) {
+      mWork++;
+      mDataOffset += info.headerBytes;
       return;
     }
+    scanField(info, [](const TypeInfo &, const uint8_t *, uint32_t) {
+      return Error(kCborOk);
+    });
+  }
+
+  /**
+   * @brief Prefetch the header following a large string or typed array so
+   * the miss overlaps with reading or skipping it.  Sequential hardware
+   * prefetch usually stops at page boundaries, which large skips cross.
+   *
+   * @param len The number of bytes about to be skipped from the current
+   * position
+   */
+  void prefetchAfter(const uint32_t len) const noexcept {
+    if (CONFIG_MICROCBOR_PREFETCH_MIN != 0 &&
+        len >= CONFIG_MICROCBOR_PREFETCH_MIN &&
+        len < mMaxBufLen - mDataOffset) {
+      MICROCBOR_PREFETCH(mBuf + mDataOffset + len);
+    }
+  }
 
-    switch (info.majorval) {
-      case kCborByteString:
-      case kCborUTF8String: {
-        mDataOffset += len;
-        break;
+  /**
+   * @brief Skip over a field, calling onString for each text or byte string
+   * within it.  Nesting is tracked with a fixed stack rather than recursion
+   * and the limits are checked as items are visited.
+   *
+   * On failure the position is moved to the end of the buffer so callers
+   * looping over items stop.
+   *
+   * @param info The field
+   * @param onString Called as Error onString(const TypeInfo &info,
+   * const uint8_t *data, uint32_t length).  Return an error other than
+   * kCborOk to stop, which is then the result.
+   * @return true if the field was skipped and onString always returned
+   * kCborOk
+   */
+  template <typename Fn>
+  bool scanField(const TypeInfo &info, Fn onString) noexcept {
+    uint32_t remaining[CONFIG_MICROCBOR_MAX_SCAN_DEPTH];
+    uint8_t depth = 0;
+    uint64_t items = 0;
+    TypeInfo field = info;
+    if (field.majorval == kCborError) {
+      // nothing to skip, e.g. the end of the buffer
+      mDataOffset = mMaxBufLen;
+      return false;
+    }
+    for (;;) {
+      if (field.majorval == kCborError) {
+        return scanFailed(kCborErrorMalformed, depth, field);
       }
-      case kCborMap: {
-        while (len--) {
-          // Skip key/value pair
-          auto key = getNextField();
-          skipField(key);
-          auto value = getNextField();
-          skipField(value);
-        }
-        break;
+      if (mWork >= mLimits.maxWork) {
+        return scanFailed(kCborErrorLimit, depth, field);
+      }
+      mWork++;
+      const uint32_t len = getFieldValue(field);
+      mDataOffset += field.headerBytes;
+      if (mDataOffset > mMaxBufLen) {
+        return scanFailed(kCborErrorMalformed, depth, field);
       }
-      case kCborArray:
-        while (len--) {
-          auto field = getNextField();
-          skipField(field);
+      const uint32_t available = mMaxBufLen - mDataOffset;
+      switch (field.majorval) {
+        case kCborByteString:
+        case kCborUTF8String: {
+          if (len > mLimits.maxStringLength) {
+            return scanFailed(kCborErrorLimit, depth, field);
+          }
+          if (len > available) {
+            return scanFailed(kCborErrorMalformed, depth, field);
+          }
+          prefetchAfter(len);
+          const Error error = onString(field, mBuf + mDataOffset, len);
+          if (error != kCborOk) {
+            return scanFailed(error, depth, field);
+          }
+          mDataOffset += len;
+          break;
         }
-      default:
-        break;
+        case kCborMap:
+        case kCborArray: {
+          if (len == 0) {
+            break;
+          }
+          // every item takes at least one byte
+          const uint64_t n = field.majorval == kCborMap ? 2 * uint64_t(len) : len;
+          items += len;
+          if (len > mLimits.maxContainerItems || items > mLimits.maxItems ||
+              depth >= mLimits.maxDepth ||
+              depth >= CONFIG_MICROCBOR_MAX_SCAN_DEPTH) {
+            return scanFailed(kCborErrorLimit, depth, field);
+          }
+          if (n > available) {
+            return scanFailed(kCborErrorMalformed, depth, field);
+          }
+          remaining[depth++] = uint32_t(n);
+          break;
+        }
+        default:
+          break;
+      }
+      while (depth > 0 && remaining[depth - 1] == 0) {
+        depth--;
+      }
+      if (depth == 0) {
+        return true;
+      }
+      remaining[depth - 1]--;
+      field = getNextField();
     }
   }
 
+  /**
+   * @brief Stop a scan, moving to the end of the buffer so callers looping
+   * over items stop too.
+   *
+   * @param error The error to record
+   * @param depth The nesting level within the item being skipped
+   * @param field The item that failed
+   * @return false
+   */
+  MICROCBOR_COLD bool scanFailed(const Error error, const uint8_t depth,
+                                 const TypeInfo &field) noexcept {
+    if (field.p != nullptr) {
+      mDataOffset = uint32_t(field.p - mBuf);
+    }
+    fail(error, depth);
+    mDataOffset = mMaxBufLen;
+    return false;
+  }
+
+  /**
+   * @brief Record a failure with the position and depth where it happened.
+   * Only the first failure is kept.  Out of line so the checks calling it
+   * stay small.
+   *
+   * @param error The error
+   * @param depth The nesting depth at the failure
+   * @return Error The first failure
+   */
+  MICROCBOR_COLD Error fail(const Error error, const int depth) noexcept {
+    if (mResult == kCborOk) {
+      mResult = error;
+      mErrorOffset = mDataOffset;
+      mErrorDepth = depth;
+    }
+    return mResult;
+  }
+  MICROCBOR_COLD Error fail(const Error error) noexcept {
+    return fail(error, mDepth + 1);
+  }
+
   /**
    * @brief Find the named element in a map.
    *
@@ -330,12 +739,19 @@ class MicroCbor {
    * If a match is found the return value reflects information about the field
    * after the name.
    *
+   * If name is null the current item is returned.  This is used to read list
+   * items which have no key.
+   *
    * @param name
    * @return TypeInfo
    */
   TypeInfo findElement(const char *name) noexcept {
     auto mapOffset = mDataOffset;
     auto info = getNextField();
+    if (name == nullptr) {
+      mDataOffset = mapOffset;
+      return info;
+    }
     // We must be in a map to find anything
     if (info.majorval != kCborMap) {
       return TypeInfo(kCborError);
@@ -343,11 +759,24 @@ class MicroCbor {
 
     auto len = strlen(name);
     auto numItems = getFieldValue(info);
+    if (numItems > mLimits.maxContainerItems) {
+      fail(kCborErrorLimit, 0);
+      return TypeInfo(kCborError);
+    }
     mDataOffset += info.headerBytes;  // skip map length
+    if (numItems != 0 && !mayHoldKey(mDataOffset, name, len)) {
+      mDataOffset = mapOffset;
+      return TypeInfo(kCborError);
+    }
     while (numItems-- != 0) {
       auto s = getNextField();
       auto sLen = getFieldValue(s);
-      const auto key = (const char *)mBuf + mDataOffset + info.headerBytes;
+      if (s.majorval == kCborError ||
+          (s.majorval == kCborUTF8String &&
+           sLen > mMaxBufLen - mDataOffset - s.headerBytes)) {
+        break;
+      }
+      const auto key = (const char *)mBuf + mDataOffset + s.headerBytes;
       if (len <= sLen && strncmp(name, key, sLen) == 0) {
         skipField(s);  // skip over name
         auto value = getNextField();
@@ -390,9 +819,8 @@ class MicroCbor {
     reserveBytes(3);
     if (mResult == 0) {
       uint8_t *b = mBuf + mDataOffset;
-      *b++ = tag;
-      *b++ = uint8_t(value >> 8);
-      *b = uint8_t(value);
+      b[0] = tag;
+      store(b + 1, value);
       mDataOffset += 3;
     }
   }
@@ -400,13 +828,8 @@ class MicroCbor {
     reserveBytes(5);
     if (mResult == 0) {
       uint8_t *b = mBuf + mDataOffset;
-      // printk("val=%08x\n",value);
-
-      *b++ = tag;
-      *b++ = value >> 24;
-      *b++ = value >> 16;
-      *b++ = value >> 8;
-      *b++ = uint8_t(value);
+      b[0] = tag;
+      store(b + 1, value);
       mDataOffset += 5;
     }
   }
@@ -421,15 +844,8 @@ class MicroCbor {
     reserveBytes(9);
     if (mResult == 0) {
       uint8_t *b = mBuf + mDataOffset;
-      *b++ = tag;
-      *b++ = value >> 56;
-      *b++ = value >> 48;
-      *b++ = value >> 40;
-      *b++ = value >> 32;
-      *b++ = value >> 24;
-      *b++ = value >> 16;
-      *b++ = value >> 8;
-      *b++ = uint8_t(value);
+      b[0] = tag;
+      store(b + 1, value);
       mDataOffset += 9;
     }
   }
@@ -457,601 +873,4399 @@ class MicroCbor {
   }
 
   /**
-   * @brief Encode a type tag.
-   * Type tags can be 1-3 bytes.  This implementation only
-   * uses 1 or 2 byte tag values.
+   * @brief Encode a signed integer using the fewest bytes.
    *
-   * @param tag
+   * @param value
    */
-  inline void encodeTag(const uint16_t tag) noexcept {
-    if (tag < 24) {
-      reserveBytes(1);
-      storeByte(kCborTag << 5 | tag);
-    } else if (tag < 256) {
-      reserveBytes(2);
-      storeByte(kCborTag << 5 | 24);
-      storeByte(tag);
+  void encodeInteger(const int64_t value) noexcept {
+    const uint8_t majorval = value < 0 ? kCborNegInt : kCborPosInt;
+    const uint64_t magnitude = value < 0 ? uint64_t(-1 - value) : value;
+    if (magnitude > 0xffffffff) {
+      encodeUInt64(majorval << 5 | 27, magnitude);
     } else {
-      reserveBytes(3);
-      storeByte(kCborTag << 5 | 25);
-      storeByte(tag >> 8);
-      storeByte(tag);
+      encodeHeader(majorval, uint32_t(magnitude));
     }
   }
 
   /**
-   * @brief Encode a string into the output buffer.
+   * @brief Read a signed integer field.
    *
-   * If nullTerminate is true an extra byte is serialized to allow null
-   * terminated strings to be used 'inplace' when decoding.
-   *
-   * @param value The string to encode.
-   * @param nullTerminate true to add null termination to the output stream.
+   * @param info The field
+   * @param value Set to the value of the field
+   * @return true if the field is an integer
    */
-  void encodeString(const char *value,
-                    const bool nullTerminate = false) noexcept {
-    auto len = strlen(value);
-    if (nullTerminate) {
-      len++;
-    }
-    encodeHeader(kCborUTF8String, len);
-    reserveBytes(len);
-
-    if (mResult == 0) {
-      memcpy(mBuf + mDataOffset, value, len);
-      mDataOffset += len;
+  bool readInteger(const TypeInfo &info, int64_t &value) noexcept {
+    const auto magnitude = getFieldValue<uint64_t>(info);
+    if (info.majorval == kCborPosInt) {
+      value = int64_t(magnitude);
+    } else if (info.majorval == kCborNegInt) {
+      value = -1 - int64_t(magnitude);
+    } else {
+      return false;
     }
+    return true;
   }
 
-  inline void encodeMapKey(const char *value) {
-    if (value == nullptr || *value == 0) {
-      return;  // ignore.  Used for 'List' encoding
+  /**
+   * @brief Read a float32 or float64 field.
+   *
+   * @param info The field
+   * @param value Set to the value of the field
+   * @return true if the field is a float
+   */
+  bool readFloat(const TypeInfo &info, double &value) noexcept {
+    if (info.majorval != kCborSimple) {
+      return false;
     }
-    mMapState[mDepth].mapCount++;
-    encodeString(value);
+    if (info.minorval == 26) {
+      uint32_t f = getFieldValue(info);
+      float f32;
+      memcpy(&f32, &f, sizeof(f32));
+      value = f32;
+      return true;
+    }
+    if (info.minorval == 27) {
+      uint64_t f = getFieldValue<uint64_t>(info);
+      memcpy(&value, &f, sizeof(value));
+      return true;
+    }
+    return false;
   }
 
   /**
-   * @brief Encode a sequency of bytes into the output buffer
+   * @brief Get the magnitude of a bignum (tag 2 or 3) without leading zeros.
    *
-   * @param bytes A pointer to the bytes to transfer to the output buffer
-   * @param numBytes The number of bytes to encode
+   * @param info The field
+   * @param p Set to the first byte of the big-endian magnitude
+   * @param length Set to the number of magnitude bytes
+   * @return true if the field is a bignum
    */
-  inline void encodeBytes(const void *bytes, const uint32_t numBytes) noexcept {
-    encodeHeader(kCborByteString, numBytes);
-
-    reserveBytes(numBytes);
-    if (mResult == 0) {
-      memcpy(mBuf + mDataOffset, bytes, numBytes);
-      mDataOffset += numBytes;
+  bool readBignum(const TypeInfo &info, const uint8_t *&p,
+                  uint32_t &length) noexcept {
+    if ((info.tag != kCborTagPositiveBignum &&
+         info.tag != kCborTagNegativeBignum) ||
+        info.majorval != kCborByteString) {
+      return false;
     }
+    p = info.p + info.headerBytes;
+    length = getFieldValue(info);
+    if (uint32_t(p - mBuf) > mMaxBufLen ||
+        length > mMaxBufLen - uint32_t(p - mBuf)) {
+      return false;
+    }
+    while (length > 0 && *p == 0) {
+      p++;
+      length--;
+    }
+    return true;
   }
 
- public:
-  MicroCbor() { this->initBuffer((void *)0, 0); }
+#ifdef __SIZEOF_INT128__
   /**
-   * @brief Construct a new Micro Cbor object
+   * @brief Read an integer or a bignum of up to 128 bits.
    *
-   * @param buf A pointer to a working i/o buffer
-   * @param maxBufLen The length in bytes of the buffer
-   * @param nullTermiante True to null terminate user strings when serializing
-   * to assist with in-place reads
+   * @param info The field
+   * @param negative Set true if the value is -1 - magnitude
+   * @param magnitude Set to the magnitude of the value
+   * @return true if the field is an integer that fits in 128 bits
    */
-  MicroCbor(void *buf, const uint32_t maxBufLen,
-            const bool nullTerminate = true)
-      : mNullTerminate(nullTerminate) {
-    this->initBuffer(buf, maxBufLen);
+  bool readInt128(const TypeInfo &info, bool &negative,
+                  unsigned __int128 &magnitude) noexcept {
+    if (info.majorval == kCborPosInt || info.majorval == kCborNegInt) {
+      negative = info.majorval == kCborNegInt;
+      magnitude = getFieldValue<uint64_t>(info);
+      return true;
+    }
+    const uint8_t *p;
+    uint32_t length;
+    if (!readBignum(info, p, length) || length > 16) {
+      return false;
+    }
+    negative = info.tag == kCborTagNegativeBignum;
+    magnitude = 0;
+    if (length > 8) {
+      // most significant part first, then a single 64 bit load
+      for (; length > 8; length--) {
+        magnitude = magnitude << 8 | *p++;
+      }
+    }
+    uint64_t low = 0;
+    for (uint32_t i = 0; i < length; i++) {
+      low = low << 8 | p[i];
+    }
+    magnitude = magnitude << (8 * length) | low;
+    return true;
   }
 
   /**
-   * @brief Construct a new Micro Cbor object with a read-only buffer.
-   *
-   * This instance can only be used for decoding.
+   * @brief Encode a 128 bit magnitude as an integer if it fits in 64 bits,
+   * otherwise as a bignum.
    *
-   * @param buf A pointer to a working i/o buffer
-   * @param maxBufLen The length in bytes of the buffer
-   * @param nullTermiante True to null terminate user strings to assist with
-   * in-place reads
+   * @param negative true if the value is -1 - magnitude
+   * @param magnitude
    */
-  MicroCbor(const void *buf, const uint32_t maxBufLen,
-            const bool nullTerminate = false)
-      : mNullTerminate(nullTerminate) {
-    this->initBuffer(buf, maxBufLen);
+  void encodeInt128(const bool negative, const unsigned __int128 magnitude) {
+    const uint8_t majorval = negative ? kCborNegInt : kCborPosInt;
+    if (uint64_t(magnitude >> 64) == 0) {
+      const uint64_t value = uint64_t(magnitude);
+      if (value > 0xffffffff) {
+        encodeUInt64(majorval << 5 | 27, value);
+      } else {
+        encodeHeader(majorval, uint32_t(value));
+      }
+      return;
+    }
+    uint8_t bytes[16];
+    for (int i = 15; i >= 0; i--) {
+      bytes[i] = uint8_t(magnitude >> (8 * (15 - i)));
+    }
+    uint32_t skip = 0;
+    while (bytes[skip] == 0) {
+      skip++;
+    }
+    encodeTag(negative ? kCborTagNegativeBignum : kCborTagPositiveBignum);
+    encodeBytes(bytes + skip, 16 - skip);
   }
+#endif
 
   /**
-   * @brief Reinitialize the working buffer.
+   * @brief Get a read-only instance positioned within this buffer.
    *
-   * @param buf A pointer to a buffer
-   * @param maxBufLen The length in bytes of the buffer
+   * @param p A location in this buffer, typically a field's p or start
+   * @return MicroCbor
    */
-  inline void initBuffer(void *buf, const uint32_t maxBufLen) noexcept {
-    this->mBuf = (uint8_t *)buf;
-    this->mMaxBufLen = maxBufLen;
-    this->mDepth = -1;
-    this->mResult = 0;
-    this->mDataOffset = 0;
-    this->mBufBytesNeeded = 0;
-    this->mReadOnly = false;
+  MicroCbor readerAt(const uint8_t *p) const noexcept {
+    MicroCbor reader(p, mMaxBufLen - uint32_t(p - mBuf));
+    reader.mValidateUtf8 = mValidateUtf8;
+    reader.mLimits = mLimits;
+    return reader;
   }
 
   /**
-   * @brief Reinitialize the working buffer with a read-only buffer.
+   * @brief Check if a field holds a value of type T.
    *
-   * This buffer can only be used for decoding cbor streams.
+   * With exact, integers must have been encoded with the width of T by
+   * add() and floats must have the precision of T.  Otherwise any value
+   * readable as T matches.
    *
-   * @param buf A pointer to a buffer
-   * @param maxBufLen The length in bytes of the buffer
+   * @param info The field
+   * @param exact true to require the encoding add() uses for T
+   * @return true if the field can be read as T
    */
-  inline void initBuffer(const void *buf, const uint32_t maxBufLen) noexcept {
-    initBuffer(const_cast<void *>(buf), maxBufLen);
-    this->mReadOnly = true;
+  template <typename T,
+            typename std::enable_if<
+                (std::is_integral<T>::value && !std::is_same<bool, T>::value &&
+                 !kCborIsInt128<T>::value)>::type * = nullptr>
+  static bool matchesType(const TypeInfo &info, const bool exact) noexcept {
+    if (info.majorval != kCborPosInt &&
+        (info.majorval != kCborNegInt || !std::is_signed<T>::value)) {
+      return false;
+    }
+    if (exact) {
+      return info.headerBytes == 1 + sizeof(T);
+    }
+    // a negative value is -1 - n, so it fits if n is at most max() as well
+    return getFieldValue<uint64_t>(info) <=
+           uint64_t(std::numeric_limits<T>::max());
   }
-
-  /**
-   * @brief Reset the encoder/decoder state to allow using again
-   *
-   */
-  inline void restart() noexcept {
-    this->mDepth = -1;
-    this->mResult = 0;
-    this->mDataOffset = 0;
-    this->mBufBytesNeeded = 0;
+  template <typename T, typename std::enable_if<
+                            (std::is_enum<T>::value)>::type * = nullptr>
+  static bool matchesType(const TypeInfo &info, const bool exact) noexcept {
+    return matchesType<typename std::underlying_type<T>::type>(info, false);
+  }
+  template <typename T, typename std::enable_if<
+                            (std::is_same<bool, T>::value)>::type * = nullptr>
+  static bool matchesType(const TypeInfo &info, const bool exact) noexcept {
+    return info.majorval == kCborSimple &&
+           (info.minorval == 20 || info.minorval == 21);
+  }
+  template <typename T,
+            typename std::enable_if<(std::is_floating_point<T>::value)>::type
+                * = nullptr>
+  static bool matchesType(const TypeInfo &info, const bool exact) noexcept {
+    return info.majorval == kCborSimple &&
+           (info.minorval == (sizeof(T) == 4 ? 26 : 27) ||
+            (!exact && info.minorval == 26));
+  }
+  template <typename T, typename std::enable_if<
+                            (std::is_same<const char *, T>::value ||
+                             std::is_same<char *, T>::value)>::type * = nullptr>
+  static bool matchesType(const TypeInfo &info, const bool exact) noexcept {
+    return info.majorval == kCborUTF8String;
+  }
+#ifdef CONFIG_MICROCBOR_STD_CONTAINERS
+  template <typename T, typename std::enable_if<
+                            (std::is_same<std::string, T>::value)>::type * =
+                nullptr>
+  static bool matchesType(const TypeInfo &info, const bool exact) noexcept {
+    return info.majorval == kCborUTF8String;
+  }
+#endif
+  template <typename T, typename std::enable_if<
+                            (kCborHasCodec<T>::value)>::type * = nullptr>
+  static bool matchesType(const TypeInfo &info, const bool exact) noexcept {
+    return MicroCborCodec<T>::tag == kCborTagInvalid
+               ? !exact && info.majorval != kCborError
+               : info.tag == MicroCborCodec<T>::tag;
   }
 
+#if __cplusplus >= 201703L
   /**
-   * @brief Get the result of encoding.
-   * If non-zero the output buffer was not large enough.  In
-   * this case use the bytesNeeded() method to query how big
-   * the buffer needs to be.
+   * @brief Decode the first variant alternative, starting at index I, that
+   * matches a field.
    *
-   * @return Error
+   * @param info The field
+   * @param exact Passed to matchesType()
+   * @param value Set to the decoded alternative
+   * @return true if an alternative matched
    */
-  inline Error getResult() const noexcept { return mResult; }
+  template <size_t I, typename V>
+  bool getAlternative(const TypeInfo &info, const bool exact, V &value) {
+    if constexpr (I < std::variant_size<V>::value) {
+      using A = std::variant_alternative_t<I, V>;
+      if (matchesType<A>(info, exact)) {
+        value.template emplace<I>(readerAt(info.start).get(nullptr, A{}));
+        return true;
+      }
+      return getAlternative<I + 1>(info, exact, value);
+    } else {
+      return false;
+    }
+  }
 
   /**
-   * @brief Get a pointer to the internal output buffer.
+   * @brief Decode variant alternative index from a field tagged by add().
    *
-   * @return const uint8_t*
+   * @param info The field inside the variant tag
+   * @param index The alternative index from the tag
+   * @param value Set to the decoded alternative
+   * @return true if index is valid and the field matches the alternative
    */
-  inline const uint8_t *getBuffer() { return mBuf; }
+  template <size_t I, typename V>
+  bool getAlternativeAt(const TypeInfo &info, const size_t index, V &value) {
+    if constexpr (I < std::variant_size<V>::value) {
+      using A = std::variant_alternative_t<I, V>;
+      if (index == I) {
+        if (!matchesType<A>(info, false)) {
+          return false;
+        }
+        value.template emplace<I>(readerAt(info.start).get(nullptr, A{}));
+        return true;
+      }
+      return getAlternativeAt<I + 1>(info, index, value);
+    } else {
+      return false;
+    }
+  }
+#endif
 
   /**
-   * @brief Get the total number of bytes serialized.
+   * @brief Check that a range of bytes lies within the buffer.
    *
-   * @return uint32_t
+   * @param p The first byte
+   * @param bytes The number of bytes
+   * @return true if p to p + bytes is within the buffer
    */
-  inline uint32_t bytesSerialized() const noexcept { return mDataOffset; }
+  bool withinBuffer(const void *p, const size_t bytes) const noexcept {
+    const size_t offset = size_t((const uint8_t *)p - mBuf);
+    return offset <= mMaxBufLen && bytes <= mMaxBufLen - offset;
+  }
 
   /**
-   * @brief Get the total number of bytes needed to encode the supplied fields.
-   *
-   * This number can be larger than bytesSerialized() if the buffer was not
-   * large enough to hold the complete serialization.
+   * @brief Get the number of items in an array or map field, limited to the
+   * bytes remaining so corrupt counts cannot cause huge allocations.
    *
+   * @param info The field
    * @return uint32_t
    */
-  inline uint32_t bytesNeeded() const noexcept { return mBufBytesNeeded; }
+  uint32_t itemCount(const TypeInfo &info) noexcept {
+    const uint32_t count = getFieldValue(info);
+    const uint32_t remaining = mMaxBufLen - uint32_t(info.p - mBuf);
+    return count < remaining ? count : remaining;
+  }
 
   /**
-   * @brief Start a map with the indicated number of
-   * map key/value pairs.  This is a hint to the maximum
-   * number of key/value pairs.  If 0 is used it is
-   * assumed that no more than 255 fields will be present.
+   * @brief Call fn for each item of an array field with an instance
+   * positioned on the item.
    *
-   * @param numElements
-   * @return Error
+   * @param info The array field
+   * @param fn Called as fn(MicroCbor &item)
    */
-  Error startMap(const uint32_t numElements = 0) noexcept {
-    if (mReadOnly || mDepth >= CONFIG_MICROCBOR_MAX_NESTING) {
-      mResult = -1;
-      return mResult;
+  template <typename Fn>
+  void forEachItem(const TypeInfo &info, Fn fn) {
+    auto reader = readerAt(info.p);
+    reader.mDataOffset += info.headerBytes;
+    for (auto n = getFieldValue(info); n > 0; n--) {
+      auto item = reader.getNextField();
+      if (item.majorval == kCborError) {
+        return;
+      }
+      auto itemReader = reader.readerAt(item.start);
+      fn(itemReader);
+      reader.skipField(item);
     }
-    mDepth += 1;
-    mMapState[mDepth].mapStartPos = mDataOffset;
-    mMapState[mDepth].mapStartCount = numElements;
-    mMapState[mDepth].mapCount = 0;
-    encodeHeader(kCborMap, numElements);
-    return mResult;
   }
 
   /**
-   * @brief Complete map encoding
-   * If the number of fields is different than that provided to
-   * the startMap function the serialized data is updated with
-   * the actual number of fields encoded.
+   * @brief Check that a field is a typed array of T that lies within the
+   * buffer.
    *
-   * @return Error
+   * @param info The field
+   * @return true if the field is a whole number of T within the buffer
    */
-  inline Error endMap() noexcept {
-    MapState &map = mMapState[mDepth];
-    // update map count
-    if (mResult == 0 && map.mapCount != map.mapStartCount) {
-      if (map.mapCount < 24) {
-        mBuf[map.mapStartPos] = kCborMap << 5 | map.mapCount;
-      } else {
-        mBuf[map.mapStartPos] = kCborMap << 5 | 24;
-        mBuf[map.mapStartPos + 1] = uint8_t(map.mapCount);
-      }
-    }
-
-    mDepth -= 1;
-    return mResult;
+  template <typename T>
+  bool isTypedArray(const TypeInfo &info) noexcept {
+    const uint32_t bytes = getFieldValue(info);
+    return info.tag == kCborTagInfo<T>::tag &&
+           info.majorval == kCborByteString && info.headerBytes != 9 &&
+           bytes % sizeof(T) == 0 &&
+           withinBuffer(info.p + info.headerBytes, bytes);
   }
 
-  Error startMap(const char *name, uint8_t numElements = 0) {
-    encodeMapKey(name);
-    startMap();
-    return mResult;
-  }
   /**
-   * @brief Add an unsigned or signed integer value to the output buffer
+   * @brief Copy a typed array field of T.
    *
-   * @param name The key name to associate with the value
-   * @param value The value to store
-   * @return Error
+   * @param info The field
+   * @param value Where to copy the items
+   * @param length The number of items expected
+   * @return true if the field is a typed array of T with length items
    */
-  template <typename T = uint32_t,
-            typename std::enable_if<(!std::is_same<bool, T>::value)>::type * =
-                nullptr>
-  Error add(const char *name, const T value) noexcept {
-    T intValue = value;
-    encodeMapKey(name);
-    uint8_t tag = kCborPosInt << 5;
-    if (value < 0) {
-      tag = kCborNegInt << 5;
-      intValue = -1 - intValue;
+  template <typename T, typename std::enable_if<
+                            (kCborHasTagInfo<T>::value)>::type * = nullptr>
+  bool getTypedItems(const TypeInfo &info, T *value,
+                     const size_t length) noexcept {
+    if (!isTypedArray<T>(info) || getFieldValue(info) != length * sizeof(T)) {
+      return false;
     }
-
-    if (sizeof(T) == 8) {
-      encodeUInt64(tag | 27, intValue);
-    } else if (sizeof(T) == 4) {
-      encodeUInt32(tag | 26, intValue);
-    } else if (sizeof(T) == 2) {
-      encodeUInt16(tag | 25, intValue);
-    } else {
-      encodeUInt8(tag | 24, intValue);
+    if (length != 0) {
+      memcpy(value, info.p + info.headerBytes, length * sizeof(T));
     }
-
-    return mResult;
+    return true;
+  }
+  template <typename T, typename std::enable_if<
+                            (!kCborHasTagInfo<T>::value)>::type * = nullptr>
+  bool getTypedItems(const TypeInfo &info, T *value,
+                     const size_t length) noexcept {
+    return false;
   }
 
-  /**
-   * @brief Add a boolean value to the output buffer
-   *
-   * @param name The key name to associate with the value
-   * @param value The value to store
-   * @return Error
-   */
-  Error add(const char *name, const bool value) noexcept {
-    encodeMapKey(name);
-    reserveBytes(1);
-    storeByte(value ? kCborTrue : kCborFalse);
-    return mResult;
+#ifdef CONFIG_MICROCBOR_STD_VECTOR
+  template <typename T, typename std::enable_if<
+                            (kCborHasTagInfo<T>::value)>::type * = nullptr>
+  bool getTypedItems(const TypeInfo &info, std::vector<T> &value) {
+    // the length is checked against the buffer before it sizes the vector
+    if (!isTypedArray<T>(info)) {
+      return false;
+    }
+    value.resize(getFieldValue(info) / sizeof(T));
+    return getTypedItems(info, value.data(), value.size());
+  }
+  template <typename T, typename std::enable_if<
+                            (!kCborHasTagInfo<T>::value)>::type * = nullptr>
+  bool getTypedItems(const TypeInfo &info, std::vector<T> &value) {
+    return false;
   }
+#endif
 
   /**
-   * @brief Add a string value to the output buffer
+   * @brief Encode the key, tag and header of a typed array and reserve space
+   * for its elements, which the caller then writes.
    *
-   * @param name The key name to associate with the value
-   * @param value The value to store
-   * @return Error
+   * @param name The key name.  Omit if null.
+   * @param numElements The number of elements
+   * @param align true to align the element data on a sizeof(T) boundary
+   * @return uint8_t* Where to write the elements or null if the buffer is
+   * full
    */
-  Error add(const char *name, const char *value) noexcept {
-    encodeMapKey(name);
-    encodeString(value, mNullTerminate);
-    return mResult;
+  template <typename T>
+  uint8_t *encodeTypedArray(const char *name, const uint32_t numElements,
+                            const bool align) noexcept {
+    const uint32_t numRawBytes = numElements * sizeof(T);
+    encodeAlignedKey(name, 2 /*tag*/ + bytesForLength(numRawBytes),
+                     align ? sizeof(T) : 1);
+    encodeTag(kCborTagInfo<T>::tag);
+    encodeHeader(kCborByteString, numRawBytes);
+    reserveBytes(numRawBytes);
+    if (mResult != 0) {
+      return nullptr;
+    }
+    uint8_t *out = mBuf + mDataOffset;
+    mDataOffset += numRawBytes;
+    return out;
   }
 
   /**
-   * @brief Add a string value to the output buffer
-   *
-   * @param name The key name to associate with the value
-   * @param value The value to store
-   * @return Error
+   * @brief Encode a known number of elements from an iterator as a typed
+   * array, writing each element straight into the output buffer.
    */
-  Error add(const char *name, char *value) noexcept {
-    encodeMapKey(name);
-    encodeString(value, mNullTerminate);
+  template <typename T, typename It,
+            typename std::enable_if<(kCborHasTagInfo<T>::value)>::type * =
+                nullptr>
+  Error addCounted(const char *name, It first, const uint32_t numElements,
+                   const bool align) {
+    uint8_t *out = encodeTypedArray<T>(name, numElements, align);
+    if (out != nullptr) {
+      for (uint32_t i = 0; i < numElements; i++, ++first, out += sizeof(T)) {
+        const T value = *first;
+        memcpy(out, &value, sizeof(T));
+      }
+    }
     return mResult;
   }
 
   /**
-   * @brief Add a unsigned or signed integer value to the output buffer
-   *  The value is stored to reduce storage when possible.
-   *
-   * @param name The key name to associate with the value
-   * @param value The value to store
-   * @return Error
+   * @brief Encode a known number of elements from an iterator as an array.
    */
-  template <typename T = uint32_t,
-            typename std::enable_if<(!std::is_same<bool, T>::value)>::type * =
+  template <typename T, typename It,
+            typename std::enable_if<(!kCborHasTagInfo<T>::value)>::type * =
                 nullptr>
-  Error addMinimal(const char *name, const T value) noexcept {
-    encodeMapKey(name);
-    if (value >= 0) {
-      encodeHeader(kCborPosInt, value);
-    } else {
-      encodeHeader(kCborNegInt, -1 - value);
+  Error addCounted(const char *name, It first, const uint32_t numElements,
+                   const bool align) {
+    startArray(name, numElements);
+    for (uint32_t i = 0; i < numElements; i++, ++first) {
+      add(nullptr, *first);
     }
-    return mResult;
+    return endArray();
   }
 
+#ifdef CONFIG_MICROCBOR_STD_CONTAINERS
   /**
-   * @brief Add a float32 value to the output buffer
-   *
-   * @param name The key name to associate with the value
-   * @param value The value to store
-   * @return Error
+   * @brief Encode items as a typed array if numeric, otherwise as an array.
    */
-  Error add(const char *name, const float value) noexcept {
-    const void *p = &value;
-
-    encodeMapKey(name);
-    encodeUInt32(kCborFloat32, *(uint32_t *)p);
-    return mResult;
+  template <typename T, typename std::enable_if<
+                            (kCborHasTagInfo<T>::value)>::type * = nullptr>
+  Error addItems(const char *name, const T *value, const uint32_t numElements,
+                 const bool align) {
+    return add(name, value, numElements, align);
+  }
+  template <typename T, typename std::enable_if<
+                            (!kCborHasTagInfo<T>::value)>::type * = nullptr>
+  Error addItems(const char *name, const T *value, const uint32_t numElements,
+                 const bool align) {
+    startArray(name, numElements);
+    for (uint32_t i = 0; i < numElements; i++) {
+      add(nullptr, value[i]);
+    }
+    return endArray();
   }
 
   /**
-   * @brief Add a float64 value to the output buffer
-   *
-   * @param name The key name to associate with the value
-   * @param value The value to store
-   * @return Error
+   * @brief Encode a container of string keyed pairs as a map.  The size is
+   * known up front so the map header is never patched.
    */
-  Error add(const char *name, const double value) noexcept {
-    const void *p = &value;
-    encodeMapKey(name);
-    encodeUInt64(kCborFloat64, *(uint64_t *)p);
-    return mResult;
+  template <typename M>
+  Error addPairs(const char *name, const M &value) {
+    startMap(name, value.size());
+    for (const auto &pair : value) {
+      add(pair.first.c_str(), pair.second);
+    }
+    return endMap();
   }
 
   /**
-   * @brief Add an array of data to the output buffer
+   * @brief Decode a map field into a container of string keyed pairs.
    *
-   * @param name The key name to associate with the value.  Omit if null.
-   * @param value The value to store
-   * @return Error
+   * @param info The field
+   * @param value The container to insert into
+   * @return true if the field is a map
    */
-  template <typename T>
-  Error add(const char *name, const T *value, const uint32_t numElements,
-            const bool align = true) {
-    const auto numRawBytes = numElements * sizeof(T);
-    if (name != nullptr && align) {
-      // compute the length of the name header to get offset for vector data
-      // If padding is needed, inject nulls after the key name string
-      auto len = strlen(name);
-      auto preambleBytes =
-          len + bytesForLength(len) + 2 /*tag*/ + bytesForLength(numRawBytes);
-      auto vectorOffset = mBufBytesNeeded + preambleBytes;
-      auto alignBytes = sizeof(T);
-      auto oddBytes = vectorOffset % alignBytes;
-
-      if (oddBytes == 0) {
-        encodeMapKey(name);
-      } else {
-        auto paddingNeeded = alignBytes - oddBytes;
-        // Add key/value pair
-        encodeHeader(kCborUTF8String, len + paddingNeeded);
-        reserveBytes(len + paddingNeeded);
-        if (mResult == 0) {
-          memcpy(mBuf + mDataOffset, name, len);
-          memset(mBuf + mDataOffset + len, 0, paddingNeeded);
-          mDataOffset += len + paddingNeeded;
-        }
+  template <typename M>
+  bool getPairs(const TypeInfo &info, M &value) {
+    if (info.majorval != kCborMap) {
+      return false;
+    }
+    auto reader = readerAt(info.p);
+    reader.mDataOffset += info.headerBytes;
+    auto n = getFieldValue(info);
+    if (n > 0 && reader.skipKeyFilter()) {
+      n--;
+    }
+    for (; n > 0; n--) {
+      auto key = reader.getNextField();
+      if (key.majorval != kCborUTF8String) {
+        return false;
       }
-    } else {
-      encodeMapKey(name);
+      const char *s = (const char *)(key.p + key.headerBytes);
+      // keys may be padded with nulls to align arrays
+      std::string k(s, strnlen(s, getFieldValue(key)));
+      reader.skipField(key);
+      auto item = reader.getNextField();
+      if (item.majorval == kCborError) {
+        return false;
+      }
+      value.emplace(std::move(k), reader.readerAt(item.start)
+                                      .get(nullptr, typename M::mapped_type{}));
+      reader.skipField(item);
     }
-    encodeTag(kCborTagInfo<T>::tag);
-    encodeBytes(value, numRawBytes);
-    return mResult;
+    return true;
   }
+#endif
 
-#ifdef CONFIG_MICROCBOR_STD_VECTOR
+#ifdef CONFIG_MICROCBOR_STD_CHRONO
   /**
-   * @brief Add a std::vector<numeric> value to the output buffer
-   *
-   * @param name The key name to associate with the value
-   * @param value The value to store
-   * @return Error
+   * @brief The tag of a time point of Clock.  Only system_clock counts from
+   * the Unix epoch, so other clocks are encoded as durations.
    */
-  template <typename T>
-  inline Error add(const char *name, const std::vector<T> &value,
-                   const bool align = true) noexcept {
-    return add(name, value.data(), value.size(), align);
+  template <typename Clock>
+  static constexpr uint16_t timeTag() noexcept {
+    return std::is_same<Clock, std::chrono::system_clock>::value
+               ? kCborTagTimeExt
+               : kCborTagDurationExt;
   }
-#endif
 
   /**
-   * @brief Get a map element with the specified key name.
-   * If the key name is not present or is not a map an empty MicroCbor instance
-   * is returned.
+   * @brief Encode a time (tag 1 or 1001) or duration (tag 1002).
    *
-   * @param name The key name to look up.
-   * @return A MicroCbor instance suitable for reading values from the map.
+   * Times in whole seconds use tag 1 with an integer.  Otherwise a map of
+   * seconds (key 1) and a milli, micro or nanosecond fraction (key -3, -6 or
+   * -9) is used.  With fixedWidth the map always holds 64 bit seconds and 32
+   * bit nanoseconds so the encoded size does not depend on the value.
+   *
+   * @param tag kCborTagTimeExt or kCborTagDurationExt
+   * @param value The time since the epoch or the duration
+   * @param fixedWidth true to always use the same number of bytes
    */
-  MicroCbor getMap(const char *name) {
-    auto element = findElement(name);
-    if (element.majorval == kCborMap) {
-      return MicroCbor(element.p, mMaxBufLen - mDataOffset);
+  template <typename Rep, typename Period>
+  void encodeTime(const uint16_t tag,
+                  const std::chrono::duration<Rep, Period> &value,
+                  const bool fixedWidth) noexcept {
+    // split before converting so durations beyond +/-292 years do not
+    // overflow nanoseconds
+    const auto whole = std::chrono::duration_cast<std::chrono::seconds>(value);
+    int64_t secs = whole.count();
+    int64_t nanos =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(value - whole)
+            .count();
+    if (nanos < 0) {
+      secs -= 1;
+      nanos += 1000000000;
+    }
+
+    if (fixedWidth) {
+      encodeTag(tag);
+      encodeHeader(kCborMap, 2);
+      encodeHeader(kCborPosInt, 1);
+      encodeUInt64((secs < 0 ? kCborNegInt : kCborPosInt) << 5 | 27,
+                   secs < 0 ? uint64_t(-1 - secs) : secs);
+      encodeHeader(kCborNegInt, 8);  // -9
+      encodeUInt32(kCborPosInt << 5 | 26, uint32_t(nanos));
+      return;
+    }
+    if (nanos == 0 && tag == kCborTagTimeExt) {
+      encodeTag(kCborTagEpochTime);
+      encodeInteger(secs);
+      return;
+    }
+    encodeTag(tag);
+    encodeHeader(kCborMap, nanos == 0 ? 1 : 2);
+    encodeHeader(kCborPosInt, 1);
+    encodeInteger(secs);
+    if (nanos == 0) {
+      return;
+    }
+    if (nanos % 1000000 == 0) {
+      encodeHeader(kCborNegInt, 2);  // -3
+      encodeHeader(kCborPosInt, uint32_t(nanos / 1000000));
+    } else if (nanos % 1000 == 0) {
+      encodeHeader(kCborNegInt, 5);  // -6
+      encodeHeader(kCborPosInt, uint32_t(nanos / 1000));
     } else {
-      return MicroCbor();
+      encodeHeader(kCborNegInt, 8);  // -9
+      encodeHeader(kCborPosInt, uint32_t(nanos));
     }
   }
 
   /**
-   * @brief Get an unsigned or signed integer value with the specified key name.
-   * If the value is not present, the default value is returned.
+   * @brief Decode a time (tag 1 or 1001) or duration (tag 1002).
    *
-   * @param name The key name to look up.
-   * @return The value in the map or the defaultValue.
+   * @param element The field
+   * @param tag kCborTagTimeExt or kCborTagDurationExt
+   * A map repeating the seconds or giving more than one fraction is
+   * malformed and sets kCborErrorMalformed.
+   *
+   * @param value Set to the time since the epoch or the duration
+   * @return true if the field holds a time or duration
    */
-  template <typename T,
-            typename std::enable_if<
-                (std::is_integral<T>::value && !std::is_same<bool, T>::value &&
-                 !std::is_same<float, T>::value)>::type * = nullptr>
-  T get(const char *name, const T defaultValue) noexcept {
-    auto element = findElement(name);
-    if (element.headerBytes == 9) {
-      uint8_t *p = element.p + 1;
-      uint64_t value = uint64_t(p[0]) << 56 | uint64_t(p[1]) << 48 |
-                       uint64_t(p[2]) << 40 | uint64_t(p[3]) << 32 |
-                       uint64_t(p[4]) << 24 | uint64_t(p[5]) << 16 |
-                       uint64_t(p[6]) << 8 | uint64_t(p[7]);
-      if (element.majorval == kCborPosInt) {
-        return T(value);
-      }
-      if (element.majorval == kCborNegInt) {
-        return T(-value - 1);
+  bool decodeTime(const TypeInfo &element, const uint16_t tag,
+                  std::chrono::nanoseconds &value) noexcept {
+    // seconds are limited so any fractions can be added without overflow
+    constexpr int64_t kMaxSeconds = INT64_MAX / 1000000000 - 3;
+    int64_t secs = 0;
+    double fsecs;
+    if (element.tag == kCborTagEpochTime && tag == kCborTagTimeExt) {
+      if (readInteger(element, secs)) {
+        if (secs < -kMaxSeconds || secs > kMaxSeconds) {
+          return false;
+        }
+        value = std::chrono::seconds(secs);
+        return true;
       }
-    } else {
-      auto value = getFieldValue(element);
-      if (element.majorval == kCborPosInt) {
-        return T(value);
+      if (readFloat(element, fsecs)) {
+        // false for NaN
+        if (!(fsecs > -kMaxSeconds && fsecs < kMaxSeconds)) {
+          return false;
+        }
+        value = std::chrono::nanoseconds(int64_t(fsecs * 1e9));
+        return true;
       }
-      if (element.majorval == kCborNegInt) {
-        return T(-value - 1);
+      return false;
+    }
+    if (element.tag != tag || element.majorval != kCborMap) {
+      return false;
+    }
+
+    auto reader = readerAt(element.p);
+    reader.mDataOffset += element.headerBytes;
+    bool haveSeconds = false;
+    bool haveFraction = false;
+    int64_t nanos = 0;
+    for (auto n = getFieldValue(element); n > 0; n--) {
+      int64_t key = 0;
+      auto keyField = reader.getNextField();
+      bool isInt = readInteger(keyField, key);
+      reader.skipField(keyField);
+      auto field = reader.getNextField();
+      int64_t v;
+      if (!isInt || field.majorval == kCborError) {
+        return false;
+      } else if ((key == 1 && haveSeconds) ||
+                 ((key == -3 || key == -6 || key == -9) && haveFraction)) {
+        // repeats could overflow the sum
+        fail(kCborErrorMalformed);
+        return false;
+      } else if (key == 1 && readInteger(field, v)) {
+        if (v < -kMaxSeconds || v > kMaxSeconds) {
+          return false;
+        }
+        secs = v;
+        haveSeconds = true;
+      } else if (key == 1 && readFloat(field, fsecs)) {
+        if (!(fsecs > -kMaxSeconds && fsecs < kMaxSeconds)) {
+          return false;
+        }
+        secs = 0;
+        nanos += int64_t(fsecs * 1e9);
+        haveSeconds = true;
+      } else if (key == -3 || key == -6 || key == -9) {
+        // fractions are below one second
+        const int64_t scale = key == -3 ? 1000000 : (key == -6 ? 1000 : 1);
+        if (!readInteger(field, v) || v < 0 || v >= 1000000000 / scale) {
+          return false;
+        }
+        nanos += v * scale;
+        haveFraction = true;
       }
+      reader.skipField(field);
     }
-    return defaultValue;
+    value = std::chrono::seconds(secs) + std::chrono::nanoseconds(nanos);
+    return haveSeconds;
   }
+#endif
 
   /**
-   * @brief Get a boolean value with the specified key name.  If the value is
-   * not present, the default value is returned.
+   * @brief Encode a type tag.
+   * Type tags can be 1-3 bytes.  This implementation only
+   * uses 1 or 2 byte tag values.
    *
-   * @param name The key name to look up.
-   * @return The value in the map or the defaultValue.
-   * @return bool
+   * @param tag
    */
-  template <typename T, typename std::enable_if<
-                            (std::is_same<bool, T>::value)>::type * = nullptr>
-  T get(const char *name, const T defaultValue) noexcept {
-    auto element = findElement(name);
-
-    if (element.majorval == kCborSimple) {
-      if (element.minorval == 20) {
-        return false;
-      } else if (element.minorval == 21) {
-        return true;
-      } else {
-        return defaultValue;
-      }
+  inline void encodeTag(const uint16_t tag) noexcept {
+    if (tag < 24) {
+      reserveBytes(1);
+      storeByte(kCborTag << 5 | tag);
+    } else if (tag < 256) {
+      reserveBytes(2);
+      storeByte(kCborTag << 5 | 24);
+      storeByte(tag);
+    } else {
+      reserveBytes(3);
+      storeByte(kCborTag << 5 | 25);
+      storeByte(tag >> 8);
+      storeByte(tag);
     }
+  }
 
-    return defaultValue;
+  /**
+   * @brief Encode a string into the output buffer.
+   *
+   * If nullTerminate is true an extra byte is serialized to allow null
+   * terminated strings to be used 'inplace' when decoding.
+   *
+   * @param value The string to encode.
+   * @param nullTerminate true to add null termination to the output stream.
+   */
+  void encodeString(const char *value,
+                    const bool nullTerminate = false) noexcept {
+    encodeString(value, strlen(value), nullTerminate);
   }
 
   /**
-   * @brief Get a float value with the specified key name.  If the value is
-   * not present, the default value is returned.
+   * @brief Encode a string of known length into the output buffer.
    *
-   * @param name The key name to look up.
-   * @return The value in the map or the defaultValue.
-   * @return float
+   * @param value The string to encode.  If nullTerminate is true value[len]
+   * must be the null terminator.
+   * @param len The length of the string
+   * @param nullTerminate true to add null termination to the output stream.
    */
-  template <typename T, typename std::enable_if<
-                            (std::is_same<float, T>::value)>::type * = nullptr>
-  T get(const char *name, const T defaultValue) noexcept {
-    auto element = findElement(name);
+  void encodeString(const char *value, uint32_t len,
+                    const bool nullTerminate) noexcept {
+    if (nullTerminate) {
+      len++;
+    }
+    encodeHeader(kCborUTF8String, len);
+    reserveBytes(len);
 
-    if (element.majorval == kCborSimple) {
-      if (element.minorval == 26) {
-        uint32_t f = getFieldValue(element);
-        return *(float *)&f;
-      } else {
-        return defaultValue;
-      }
+    if (mResult == 0) {
+      memcpy(mBuf + mDataOffset, value, len);
+      mDataOffset += len;
     }
+  }
 
-    return defaultValue;
+  inline void encodeMapKey(const char *value) {
+    if (value == nullptr || *value == 0) {
+      countListItem();
+      return;  // ignore.  Used for 'List' encoding
+    }
+    if (mDepth >= 0) {
+      MapState &state = mMapState[mDepth];
+      state.mapCount++;
+      if (state.filterPos != 0) {
+        setFilterBits(mBuf + state.filterPos, state.filterBytes, value,
+                      strlen(value));
+      }
+    }
+    encodeString(value);
   }
 
   /**
-   * @brief Get a string value with the specified key name.  If the value is
-   * not present, the default value is returned.
-   *
-   * This method returns a pointer to the beginning of the string and assumes
-   * that this encoder has been used to encode a string with a null termination
-   * for convenience.
+   * @brief Count an unnamed item if it is being added to an array.
    *
-   * @param name The key name to look up.
-   * @return The value in the map or the defaultValue.
-   * @return Pointer to string
+   * For homogeneous arrays the size of each item is tracked so endArray()
+   * knows whether items can be located arithmetically.
    */
-  template <typename T, typename std::enable_if<
-                            (std::is_same<const char *, T>::value ||
-                             std::is_same<char *, T>::value)>::type * = nullptr>
-  const char *get(const char *name, T defaultValue) noexcept {
-    auto element = findElement(name);
-    if (element.majorval == kCborUTF8String) {
-      const char *s = (const char *)(element.p + element.headerBytes);
-      return s;
+  inline void countListItem() noexcept {
+    if (mDepth < 0 || !mMapState[mDepth].isArray) {
+      return;
     }
+    MapState &list = mMapState[mDepth];
+    if (list.homogeneous) {
+      trackListItem(list, mBufBytesNeeded);
+    }
+    list.mapCount++;
+  }
 
-    return defaultValue;
+  void trackListItem(MapState &list, const uint32_t itemStart) noexcept {
+    if (list.mapCount == 1) {
+      list.itemSize = itemStart - list.itemStart;
+    } else if (list.mapCount > 1 && itemStart - list.itemStart != list.itemSize) {
+      list.homogeneous = false;
+    }
+    list.itemStart = itemStart;
   }
 
   /**
-   * @brief Get the length of an item.
+   * @brief Start a map or array.
    *
-   * Depending on the item, the length can have different meanings so the use of
-   * this function is 'user beware'.
+   * @param majorval kCborMap or kCborArray
+   * @param numElements The expected number of elements
+   * @param homogeneous true to tag an array as homogeneous
+   * @return Error
+   */
+  Error startContainer(const uint8_t majorval, const uint32_t numElements,
+                       const bool homogeneous) noexcept {
+    if (mReadOnly) {
+      return fail(kCborErrorReadOnly);
+    }
+    if (mDepth + 1 >= CONFIG_MICROCBOR_MAX_NESTING) {
+      return fail(kCborErrorNesting);
+    }
+    countListItem();
+    if (homogeneous) {
+      // Always 3 bytes so it can be replaced by a no-op tag in endArray()
+      reserveBytes(3);
+      storeByte(kCborTag << 5 | 25);
+      storeByte(0);
+      storeByte(kCborTagHomogeneousArray);
+    }
+    mDepth += 1;
+    MapState &state = mMapState[mDepth];
+    state.mapStartPos = mDataOffset;
+    state.mapStartCount = numElements;
+    state.mapCount = 0;
+    state.headerBytes = bytesForLength(numElements);
+    state.isArray = majorval == kCborArray;
+    state.homogeneous = homogeneous;
+    state.alignment = 1;
+    state.filterPos = 0;
+    encodeHeader(majorval, numElements);
+    state.itemStart = mBufBytesNeeded;
+    return mResult;
+  }
+
+  /**
+   * @brief Complete a map or array, updating the element count in the
+   * header if it differs from the count given at the start.
    *
-   * For arrays this returns the number of bytes.
-   * For strings it returns the length of the string not including a null
-   * termination. For maps it returns the number of items in the map
+   * If the count no longer fits in the header the contents are moved to make
+   * room.  That would break the alignment of arrays in the container, so
+   * then a count must be supplied when starting the container.
    *
-   * If the field is not found, zero is returned.
+   * @param majorval kCborMap or kCborArray
+   * @return Error kCborErrorUnsupported if moving the contents would
+   * misalign an array
+   */
+  Error endContainer(const uint8_t majorval) noexcept {
+    MapState &state = mMapState[mDepth];
+    mDepth -= 1;
+    if (mDepth >= 0) {
+      mMapState[mDepth].alignment =
+          lcm(mMapState[mDepth].alignment, state.alignment);
+    }
+    if (state.mapCount != state.mapStartCount) {
+      const uint32_t pos = state.mapStartPos;
+      uint8_t headerBytes = state.headerBytes;
+      const uint8_t needed = bytesForLength(state.mapCount);
+      if (needed > headerBytes && (needed - headerBytes) % state.alignment) {
+        return fail(kCborErrorUnsupported);
+      }
+      if (needed > headerBytes) {
+        reserveBytes(needed - headerBytes);
+        if (mResult == 0) {
+          memmove(mBuf + pos + needed, mBuf + pos + headerBytes,
+                  mDataOffset - pos - headerBytes);
+          mDataOffset += needed - headerBytes;
+          if (mChecksumPos > pos) {
+            mChecksumPos += needed - headerBytes;
+          }
+        }
+        headerBytes = needed;
+      }
+      if (mResult == 0) {
+        storeHeader(mBuf + pos, majorval, state.mapCount, headerBytes);
+      }
+    }
+    if (mDepth < 0 && mChecksumPos != 0 && mResult == 0) {
+      // The top level item is final so the checksum can be stored
+      const uint32_t start = mMapState[0].mapStartPos;
+      const uint32_t crc = crc32c(0, mBuf + start, mDataOffset - start);
+      store(mBuf + mChecksumPos, crc);
+      mChecksumPos = 0;
+    }
+    return mResult;
+  }
+
+  /**
+   * @brief Check a text string field when UTF-8 validation is enabled.
    *
-   * @param name The name of the field to find
-   * @return uint32_t
+   * @param info The string field
+   * @return true if validation is disabled or the string is valid UTF-8
    */
-  uint32_t getLength(const char *name) noexcept {
-    auto element = findElement(name);
-    if (element.majorval != kCborError) {
-      auto len = getFieldValue(element);
-      if (element.majorval == kCborUTF8String &&
-          element.p[element.headerBytes + len - 1] == 0) {
-        // do not count the attached null bytes
-        len -= 1;
+  bool isValidString(const TypeInfo &info) noexcept {
+    return !mValidateUtf8 ||
+           isValidUtf8(info.p + info.headerBytes, getFieldValue(info));
+  }
+
+  /**
+   * @brief Get the CRC32C lookup tables used when the CPU has no CRC32C
+   * instruction.  Table k advances a byte followed by k zero bytes, so 8
+   * bytes are folded in with 8 independent lookups (slicing-by-8).
+   *
+   * @return const uint32_t* 8 tables of 256 entries
+   */
+  static const uint32_t *crc32cTable() noexcept {
+    struct Table {
+      uint32_t entries[8 * 256];
+      Table() {
+        for (uint32_t i = 0; i < 256; i++) {
+          uint32_t crc = i;
+          for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+          }
+          entries[i] = crc;
+        }
+        for (uint32_t i = 256; i < 8 * 256; i++) {
+          const uint32_t prev = entries[i - 256];
+          entries[i] = (prev >> 8) ^ entries[prev & 0xff];
+        }
       }
-      return len;
-    } else {
-      return 0;
+    };
+    static const Table table;
+    return table.entries;
+  }
+
+  /**
+   * @brief Store a header using a fixed number of bytes.
+   *
+   * @param b The output location
+   * @param majorval The CBOR major type
+   * @param value The length or value, which must fit in headerBytes
+   * @param headerBytes 1, 2, 3 or 5
+   */
+  static void storeHeader(uint8_t *b, const uint8_t majorval,
+                          const uint32_t value,
+                          const uint8_t headerBytes) noexcept {
+    switch (headerBytes) {
+      case 1:
+        b[0] = majorval << 5 | value;
+        break;
+      case 2:
+        b[0] = majorval << 5 | 24;
+        b[1] = uint8_t(value);
+        break;
+      case 3:
+        b[0] = majorval << 5 | 25;
+        store(b + 1, uint16_t(value));
+        break;
+      default:
+        b[0] = majorval << 5 | 26;
+        store(b + 1, value);
+        break;
     }
   }
 
-  template <typename T>
-  struct CborArray {
-    size_t length;
-    const T *p;
-  };
   /**
-   * @brief Get a pointer to vector data.
+   * @brief Encode a sequency of bytes into the output buffer
    *
-   * If the named parameter is not present, the defaultValue is returned
+   * @param bytes A pointer to the bytes to transfer to the output buffer
+   * @param numBytes The number of bytes to encode
+   */
+  inline void encodeBytes(const void *bytes, const uint32_t numBytes) noexcept {
+    encodeHeader(kCborByteString, numBytes);
+
+    reserveBytes(numBytes);
+    if (mResult == 0) {
+      memcpy(mBuf + mDataOffset, bytes, numBytes);
+      mDataOffset += numBytes;
+    }
+  }
+
+  /**
+   * @brief Encode a map key, padding it with nulls so that the data
+   * following it lands on an alignBytes boundary.
    *
-   * @tparam T The type of vector data expected.
-   * @param name The name of the field to find
-   * @param defaultValue The value to return if the name is not present or an
-   * error occurs
-   * @return struct CborArray with length an pointer to data
+   * Alignment is relative to the start of the buffer.  Unnamed items cannot
+   * pad a key so they are preceded by no-op tags instead.
+   *
+   * @param name The key name.  If null or empty no key is encoded.
+   * @param trailerBytes The number of bytes encoded between the key and the
+   * data to be aligned
+   * @param alignBytes The alignment required for the data
    */
-  template <typename T>
-  struct CborArray<T> getPointer(const char *name,
-                                 const T *defaultValue) noexcept {
-    auto element = findElement(name);
-    if (element.tag != kCborTagInfo<T>::tag) {
-      return {.length = 0, .p = defaultValue};
+  void encodeAlignedKey(const char *name, const uint32_t trailerBytes,
+                        const uint32_t alignBytes) noexcept {
+    if (alignBytes <= 1) {
+      encodeMapKey(name);
+      return;
+    }
+    mAlignment = lcm(mAlignment, alignBytes);
+    if (mDepth >= 0) {
+      mMapState[mDepth].alignment =
+          lcm(mMapState[mDepth].alignment, alignBytes);
+    }
+    if (name == nullptr || *name == 0) {
+      encodeMapKey(name);
+      uint32_t odd = (mBufBytesNeeded + trailerBytes) % alignBytes;
+      uint32_t paddingNeeded = odd ? alignBytes - odd : 0;
+      while (!isPaddingSize(paddingNeeded)) {
+        paddingNeeded += alignBytes;
+      }
+      encodePadding(paddingNeeded);
+      return;
+    }
+    // compute the length of the name header to get offset for vector data
+    // If padding is needed, inject nulls after the key name string
+    const uint32_t len = strlen(name);
+    uint32_t paddingNeeded = 0;
+    for (;;) {
+      // the key header can grow with the padding so iterate until aligned
+      auto keyLen = len + paddingNeeded;
+      auto vectorOffset =
+          mBufBytesNeeded + bytesForLength(keyLen) + keyLen + trailerBytes;
+      auto oddBytes = vectorOffset % alignBytes;
+      if (oddBytes == 0) {
+        break;
+      }
+      paddingNeeded += alignBytes - oddBytes;
     }
-    auto length = getFieldValue(element) / sizeof(T);
-    const T *p = (T *)(element.p + element.headerBytes);
 
-    return {.length = length, .p = p};
+    if (paddingNeeded == 0) {
+      encodeMapKey(name);
+      return;
+    }
+    // Add key/value pair
+    MapState &state = mMapState[mDepth];
+    state.mapCount++;
+    if (state.filterPos != 0) {
+      setFilterBits(mBuf + state.filterPos, state.filterBytes, name, len);
+    }
+    encodeHeader(kCborUTF8String, len + paddingNeeded);
+    reserveBytes(len + paddingNeeded);
+    if (mResult == 0) {
+      memcpy(mBuf + mDataOffset, name, len);
+      memset(mBuf + mDataOffset + len, 0, paddingNeeded);
+      mDataOffset += len + paddingNeeded;
+    }
   }
-};
+
+  /**
+   * @brief The hash of a key, FNV-1a.  Used by key filters and
+   * MicroCborIndex.
+   */
+  static uint32_t hashKey(const char *key, const size_t len) noexcept {
+    uint32_t h = 0x811c9dc5;
+    for (size_t i = 0; i < len; i++) {
+      h = (h ^ uint8_t(key[i])) * 0x01000193;
+    }
+    return h;
+  }
+
+  /**
+   * @brief Mix a key hash with a seed, the murmur3 finalizer.
+   */
+  static uint32_t mixHash(uint32_t h, const uint32_t seed) noexcept {
+    h ^= seed * 0x9e3779b9;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+  }
+
+  /**
+   * @brief The filter bits of a key, two probes from one hash.
+   */
+  static void filterBits(const uint32_t filterBytes, const char *key,
+                         const size_t len, uint32_t &bit1,
+                         uint32_t &bit2) noexcept {
+    const uint32_t h = hashKey(key, len);
+    bit1 = h % (filterBytes * 8);
+    bit2 = mixHash(h, 1) % (filterBytes * 8);
+  }
+
+  static void setFilterBits(uint8_t *filter, const uint32_t filterBytes,
+                            const char *key, const size_t len) noexcept {
+    uint32_t bit1, bit2;
+    filterBits(filterBytes, key, len, bit1, bit2);
+    filter[bit1 >> 3] |= uint8_t(1 << (bit1 & 7));
+    filter[bit2 >> 3] |= uint8_t(1 << (bit2 & 7));
+  }
+
+  /**
+   * @brief Find the key filter of a map, which is the first entry when
+   * present.
+   *
+   * @param offset The offset of the first entry
+   * @param pos Set to the offset of the filter bits
+   * @param bytes Set to the size of the filter
+   * @return true if the map has a key filter
+   */
+  bool findKeyFilter(const uint32_t offset, uint32_t &pos,
+                     uint32_t &bytes) noexcept {
+    // an empty text key, whose first byte is cheap to rule out
+    if (offset >= mMaxBufLen || mBuf[offset] != (kCborUTF8String << 5)) {
+      return false;
+    }
+    const auto saved = mDataOffset;
+    mDataOffset = offset + 1;
+    const auto value = getNextField();
+    mDataOffset = saved;
+    if (value.tag != kCborTagKeyFilter || value.majorval != kCborByteString) {
+      return false;
+    }
+    bytes = getFieldValue(value);
+    pos = uint32_t(value.p - mBuf) + value.headerBytes;
+    return bytes != 0 && bytes <= mMaxBufLen - pos;
+  }
+
+  /**
+   * @brief Skip the key filter if it is the next entry of a map, so
+   * decoders of whole maps do not see it as data.
+   *
+   * @return true if a key filter was skipped
+   */
+  bool skipKeyFilter() noexcept {
+    uint32_t pos, bytes;
+    if (!findKeyFilter(mDataOffset, pos, bytes)) {
+      return false;
+    }
+    mDataOffset = pos + bytes;
+    return true;
+  }
+
+  /**
+   * @brief Check a key against the key filter of a map, if it has one.
+   *
+   * @param offset The offset of the first entry of the map
+   * @param name The key
+   * @param len The length of the key
+   * @return false if the map certainly does not hold the key
+   */
+  bool mayHoldKey(const uint32_t offset, const char *name,
+                  const size_t len) noexcept {
+    uint32_t pos, bytes;
+    if (!findKeyFilter(offset, pos, bytes)) {
+      return true;
+    }
+    uint32_t bit1, bit2;
+    filterBits(bytes, name, len, bit1, bit2);
+    return (mBuf[pos + (bit1 >> 3)] >> (bit1 & 7) & 1) &&
+           (mBuf[pos + (bit2 >> 3)] >> (bit2 & 7) & 1);
+  }
+
+  /**
+   * @brief The least common multiple of two alignments.
+   */
+  static uint32_t lcm(const uint32_t a, const uint32_t b) noexcept {
+    uint32_t x = a;
+    uint32_t y = b;
+    while (y != 0) {
+      const uint32_t t = x % y;
+      x = y;
+      y = t;
+    }
+    return a / x * b;
+  }
+
+  /**
+   * @brief The element size of an RFC 8746 typed array tag.
+   *
+   * @param tag The tag
+   * @return uint32_t The size in bytes, 0 if tag is not a typed array tag
+   */
+  static uint32_t typedArrayElementSize(const uint32_t tag) noexcept {
+    if (tag < kCborTagUint8 || tag > kCborTagUint8 + 23) {
+      return 0;
+    }
+    return (tag & 0x10 ? 2u : 1u) << (tag & 3);
+  }
+
+#ifdef CONFIG_MICROCBOR_THREADS
+  /**
+   * @brief Add the items of the open container on several threads, see
+   * addArrayParallel().
+   *
+   * The items are split in chunks which worker threads take in turn and
+   * encode into separate buffers, each in a container opened at the same
+   * depth.  The chunks are then copied in order and their counts added.
+   * Alignment is relative to the buffer start, so a chunk with aligned
+   * arrays that would land at a different alignment than it was encoded at
+   * is encoded again in place.
+   *
+   * The chunk encoders take the configuration of this one.  If fn throws,
+   * the remaining chunks are abandoned and the first exception is rethrown
+   * once all workers have finished.
+   */
+  template <typename Fn>
+  void addChunked(const uint32_t n, Fn &fn, unsigned threads) {
+    if (n == 0 || (mResult != kCborOk && mResult != kCborErrorBufferFull)) {
+      return;
+    }
+    if (threads == 0) {
+      threads = std::thread::hardware_concurrency();
+    }
+    threads = threads == 0 ? 1 : threads > n ? n : threads;
+    if (threads == 1) {
+      for (uint32_t i = 0; i < n; i++) {
+        fn(*this, i);
+      }
+      return;
+    }
+    struct Chunk {
+      std::vector<uint8_t> buf;
+      uint32_t length;
+      uint32_t count;
+      uint32_t alignment;
+      bool inPlace;  //< Holds a checksum slot so must be encoded in place
+      Error result;
+    };
+    const uint32_t numChunks = n < threads * 8 ? n : threads * 8;
+    std::vector<Chunk> chunks(numChunks);
+    const auto first = [&](const uint32_t c) {
+      return uint32_t(uint64_t(n) * c / numChunks);
+    };
+    const uint8_t majorval = mMapState[mDepth].isArray ? kCborArray : kCborMap;
+    std::atomic<uint32_t> next(0);
+    std::atomic<uint32_t> bytesPerItem(64);  // estimated from finished chunks
+    std::exception_ptr exception;  // the first thrown by fn
+    std::mutex exceptionLock;
+    const auto worker = [&]() {
+      for (uint32_t c = next++; c < numChunks; c = next++) {
+        Chunk &chunk = chunks[c];
+        const uint64_t estimate =
+            uint64_t(bytesPerItem) * (first(c + 1) - first(c)) * 5 / 4;
+        uint32_t size = estimate < UINT32_MAX / 2 ? uint32_t(estimate) : 4096;
+        try {
+          for (;;) {
+            chunk.buf.resize(size);
+            MicroCbor cbor(chunk.buf.data(), size, mNullTerminate);
+            cbor.mValidateUtf8 = mValidateUtf8;
+            cbor.mLimits = mLimits;
+            cbor.startContainer(majorval, 0, false);
+            // continue at the same depth as in place so nesting limits match
+            cbor.mMapState[mDepth] = cbor.mMapState[0];
+            cbor.mDepth = mDepth;
+            for (uint32_t i = first(c); i < first(c + 1); i++) {
+              fn(cbor, i);
+            }
+            if (cbor.mResult == kCborErrorBufferFull &&
+                cbor.mBufBytesNeeded < UINT32_MAX / 2 &&
+                size < UINT32_MAX / 2) {
+              // the size needed is known so a second attempt will fit
+              size = cbor.mBufBytesNeeded + 64;
+              continue;
+            }
+            bytesPerItem = cbor.mDataOffset / (first(c + 1) - first(c)) + 1;
+            chunk.result =
+                cbor.mDepth == mDepth ? cbor.mResult : Error(kCborErrorState);
+            chunk.length = cbor.mDataOffset;
+            chunk.count = cbor.mMapState[mDepth].mapCount;
+            chunk.alignment = cbor.mAlignment;
+            chunk.inPlace = cbor.mChecksumPos != 0;
+            break;
+          }
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(exceptionLock);
+          if (!exception) {
+            exception = std::current_exception();
+          }
+          next = numChunks;  // abandon the remaining chunks
+        }
+      }
+    };
+    std::vector<std::thread> workers;
+    try {
+      for (unsigned t = 1; t < threads; t++) {
+        workers.emplace_back(worker);
+      }
+    } catch (const std::system_error &) {
+      // continue with the workers started, this thread takes the rest
+    }
+    worker();
+    for (auto &t : workers) {
+      t.join();
+    }
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+
+    for (uint32_t c = 0; c < numChunks; c++) {
+      const Chunk &chunk = chunks[c];
+      if (chunk.result != kCborOk) {
+        fail(chunk.result);
+        return;
+      }
+      // the chunk's items follow a 1 byte container header
+      if (chunk.inPlace || (mBufBytesNeeded - 1) % chunk.alignment != 0) {
+        for (uint32_t i = first(c); i < first(c + 1); i++) {
+          fn(*this, i);
+        }
+        continue;
+      }
+      reserveBytes(chunk.length - 1);
+      if (mResult == 0) {
+        memcpy(mBuf + mDataOffset, chunk.buf.data() + 1, chunk.length - 1);
+        mDataOffset += chunk.length - 1;
+      }
+      mMapState[mDepth].mapCount += chunk.count;
+      mAlignment = lcm(mAlignment, chunk.alignment);
+      mMapState[mDepth].alignment =
+          lcm(mMapState[mDepth].alignment, chunk.alignment);
+    }
+  }
+#endif
+
+  /**
+   * @brief Check if encodePadding() can produce exactly n bytes.
+   *
+   * @param n The number of padding bytes
+   * @return true if n bytes of padding can be encoded
+   */
+  static bool isPaddingSize(const uint32_t n) noexcept {
+    return n == 0 || n == 3 || n == 5 || n == 6 || n >= 8;
+  }
+
+  /**
+   * @brief Encode padding before an item as self-described CBOR tags, which
+   * decoders ignore.  The tag is encoded as 3 bytes, or 5 bytes to make up
+   * sizes that are not a multiple of 3.
+   *
+   * @param n The number of padding bytes. Must satisfy isPaddingSize(n).
+   */
+  void encodePadding(uint32_t n) noexcept {
+    reserveBytes(n);
+    if (mResult != 0) {
+      return;
+    }
+    uint8_t *b = mBuf + mDataOffset;
+    mDataOffset += n;
+    for (uint32_t wide = (3 - n % 3) % 3; wide > 0; wide--, n -= 5) {
+      *b++ = kCborTag << 5 | 26;
+      *b++ = 0;
+      *b++ = 0;
+      *b++ = uint8_t(kCborTagSelfDescribed >> 8);
+      *b++ = uint8_t(kCborTagSelfDescribed);
+    }
+    for (; n > 0; n -= 3) {
+      *b++ = kCborTag << 5 | 25;
+      *b++ = uint8_t(kCborTagSelfDescribed >> 8);
+      *b++ = uint8_t(kCborTagSelfDescribed);
+    }
+  }
+
+  /**
+   * @brief Copy a strided multi-dimensional source into contiguous output.
+   *
+   * @param out The output location
+   * @param value The first element of the source
+   * @param dims The size of each dimension
+   * @param numDims The number of dimensions
+   * @param strides The source stride of each dimension in elements
+   * @param columnMajor true if the first dimension varies fastest in out
+   */
+  template <typename T>
+  static void encodeStrided(uint8_t *out, const T *value, const uint32_t *dims,
+                            const uint8_t numDims, const uint32_t *strides,
+                            const bool columnMajor) noexcept {
+    if (numDims == 0) {
+      memcpy(out, value, sizeof(T));
+      return;
+    }
+    // Walk the dimensions with an odometer, innermost (fastest) first
+    uint32_t index[CONFIG_MICROCBOR_MAX_TENSOR_DIMS] = {0};
+    const uint8_t inner = columnMajor ? 0 : numDims - 1;
+    const uint32_t rowLength = dims[inner];
+    const uint32_t rowStride = strides[inner];
+    for (;;) {
+      const T *row = value;
+      for (uint8_t d = 0; d < numDims; d++) {
+        row += index[d] * strides[d];
+      }
+      if (rowStride == 1) {
+        memcpy(out, row, rowLength * sizeof(T));
+        out += rowLength * sizeof(T);
+      } else {
+        for (uint32_t i = 0; i < rowLength; i++, out += sizeof(T)) {
+          memcpy(out, row + i * rowStride, sizeof(T));
+        }
+      }
+      // advance the outer dimensions
+      uint8_t n = 1;
+      for (; n < numDims; n++) {
+        const uint8_t d = columnMajor ? n : numDims - 1 - n;
+        if (++index[d] < dims[d]) {
+          break;
+        }
+        index[d] = 0;
+      }
+      if (n == numDims) {
+        return;
+      }
+    }
+  }
+
+ public:
+  MicroCbor() { this->initBuffer((void *)0, 0); }
+  /**
+   * @brief Construct a new Micro Cbor object
+   *
+   * @param buf A pointer to a working i/o buffer
+   * @param maxBufLen The length in bytes of the buffer
+   * @param nullTermiante True to null terminate user strings when serializing
+   * to assist with in-place reads
+   */
+  MicroCbor(void *buf, const uint32_t maxBufLen,
+            const bool nullTerminate = true)
+      : mNullTerminate(nullTerminate) {
+    this->initBuffer(buf, maxBufLen);
+  }
+
+  /**
+   * @brief Construct a new Micro Cbor object with a read-only buffer.
+   *
+   * This instance can only be used for decoding.
+   *
+   * @param buf A pointer to a working i/o buffer
+   * @param maxBufLen The length in bytes of the buffer
+   * @param nullTermiante True to null terminate user strings to assist with
+   * in-place reads
+   */
+  MicroCbor(const void *buf, const uint32_t maxBufLen,
+            const bool nullTerminate = false)
+      : mNullTerminate(nullTerminate) {
+    this->initBuffer(buf, maxBufLen);
+  }
+
+  /**
+   * @brief Reinitialize the working buffer.
+   *
+   * @param buf A pointer to a buffer
+   * @param maxBufLen The length in bytes of the buffer
+   */
+  inline void initBuffer(void *buf, const uint32_t maxBufLen) noexcept {
+    this->mBuf = (uint8_t *)buf;
+    this->mMaxBufLen = maxBufLen;
+    this->mDepth = -1;
+    this->mResult = 0;
+    this->mDataOffset = 0;
+    this->mBufBytesNeeded = 0;
+    this->mReadOnly = false;
+    this->mAlignmentMisses = 0;
+    this->mChecksumPos = 0;
+    this->mWork = 0;
+    this->mErrorOffset = 0;
+    this->mErrorDepth = 0;
+    this->mAlignment = 1;
+  }
+
+  /**
+   * @brief Reinitialize the working buffer with a read-only buffer.
+   *
+   * This buffer can only be used for decoding cbor streams.
+   *
+   * @param buf A pointer to a buffer
+   * @param maxBufLen The length in bytes of the buffer
+   */
+  inline void initBuffer(const void *buf, const uint32_t maxBufLen) noexcept {
+    initBuffer(const_cast<void *>(buf), maxBufLen);
+    this->mReadOnly = true;
+  }
+
+  /**
+   * @brief Reset the encoder/decoder state to allow using again
+   *
+   */
+  inline void restart() noexcept {
+    this->mDepth = -1;
+    this->mResult = 0;
+    this->mDataOffset = 0;
+    this->mBufBytesNeeded = 0;
+    this->mChecksumPos = 0;
+    this->mWork = 0;
+    this->mErrorOffset = 0;
+    this->mErrorDepth = 0;
+    this->mAlignment = 1;
+  }
+
+  /**
+   * @brief Get the result of encoding.
+   * If kCborErrorBufferFull the output buffer was not large enough.  In
+   * this case use the bytesNeeded() method to query how big
+   * the buffer needs to be.  Other MicroCborError values describe the first
+   * failure, including limits and malformed input found while decoding.
+   *
+   * @return Error
+   */
+  inline Error getResult() const noexcept { return mResult; }
+
+  /**
+   * @brief Get the buffer offset where the first failure happened.
+   *
+   * @return uint32_t
+   */
+  inline uint32_t errorOffset() const noexcept { return mErrorOffset; }
+
+  /**
+   * @brief Get the nesting depth where the first failure happened: the
+   * number of open maps and arrays when encoding, or the level within the
+   * item being skipped when decoding.
+   *
+   * @return int
+   */
+  inline int errorDepth() const noexcept { return mErrorDepth; }
+
+  /**
+   * @brief Get a pointer to the internal output buffer.
+   *
+   * @return const uint8_t*
+   */
+  inline const uint8_t *getBuffer() { return mBuf; }
+
+  /**
+   * @brief Get the total number of bytes serialized.
+   *
+   * @return uint32_t
+   */
+  inline uint32_t bytesSerialized() const noexcept { return mDataOffset; }
+
+  /**
+   * @brief Get the total number of bytes needed to encode the supplied fields.
+   *
+   * This number can be larger than bytesSerialized() if the buffer was not
+   * large enough to hold the complete serialization.
+   *
+   * @return uint32_t
+   */
+  inline uint32_t bytesNeeded() const noexcept { return mBufBytesNeeded; }
+
+  /**
+   * @brief Start a map with the indicated number of
+   * map key/value pairs.  This is a hint to the maximum
+   * number of key/value pairs.  If 0 is used it is
+   * assumed that no more than 255 fields will be present.
+   *
+   * @param numElements
+   * @return Error
+   */
+  Error startMap(const uint32_t numElements = 0) noexcept {
+    return startContainer(kCborMap, numElements, false);
+  }
+
+  /**
+   * @brief Complete map encoding
+   * If the number of fields is different than that provided to
+   * the startMap function the serialized data is updated with
+   * the actual number of fields encoded.
+   *
+   * @return Error
+   */
+  inline Error endMap() noexcept { return endContainer(kCborMap); }
+
+  Error startMap(const char *name, uint32_t numElements = 0) {
+    if (name != nullptr && *name != 0) {
+      encodeMapKey(name);
+    }
+    return startMap(numElements);
+  }
+
+  /**
+   * @brief Reopen an encoded top level map so more fields can be added,
+   * e.g. by each stage of a pipeline, without encoding it again.  Fields
+   * added before endMap() are appended and the count is patched.  If the
+   * count no longer fits in the header the map is moved once by endMap(),
+   * unless that would misalign typed arrays it holds, when endMap() fails
+   * with kCborErrorUnsupported.
+   *
+   * A checksum added with addChecksum() is not updated.
+   *
+   * @param buf The buffer holding the map, which may follow sync markers
+   * @param used The number of bytes of encoded data in buf
+   * @param maxBufLen The capacity of buf in bytes
+   * @return Error kCborErrorMalformed if buf does not hold exactly one well
+   * formed map, kCborErrorUnsupported for tagged maps or 64 bit counts
+   */
+  Error appendToMap(void *buf, const uint32_t used,
+                    const uint32_t maxBufLen) noexcept {
+    initBuffer(buf, used <= maxBufLen ? maxBufLen : 0);
+    const auto info = getNextField();
+    if (info.majorval != kCborMap) {
+      return fail(kCborErrorMalformed);
+    }
+    if (info.tag != kCborTagInvalid || info.headerBytes == 9) {
+      return fail(kCborErrorUnsupported);
+    }
+    // note the typed arrays that are aligned, which must stay so
+    uint32_t alignment = 1;
+    scanField(info, [&](const TypeInfo &field, const uint8_t *data, uint32_t) {
+      const uint32_t size = typedArrayElementSize(field.tag);
+      if (size > 1 && uint32_t(data - mBuf) % size == 0) {
+        alignment = lcm(alignment, size);
+      }
+      return Error(kCborOk);
+    });
+    if (mResult != kCborOk || mDataOffset != used) {
+      return fail(kCborErrorMalformed);
+    }
+    mDepth = 0;
+    MapState &state = mMapState[0];
+    state.mapStartPos = uint32_t(info.p - mBuf);
+    state.mapStartCount = getFieldValue(info);
+    state.mapCount = state.mapStartCount;
+    state.headerBytes = info.headerBytes;
+    state.isArray = false;
+    state.homogeneous = false;
+    state.alignment = alignment;
+    state.filterPos = 0;
+    uint32_t pos, bytes;
+    if (state.mapStartCount != 0 &&
+        findKeyFilter(state.mapStartPos + info.headerBytes, pos, bytes)) {
+      state.filterPos = pos;
+      state.filterBytes = bytes;
+    }
+    mBufBytesNeeded = used;
+    state.itemStart = mBufBytesNeeded;
+    mWork = 0;
+    return mResult;
+  }
+
+  /**
+   * @brief Add a key filter to the map just started so lookups of keys it
+   * does not hold return the default without scanning it.  Useful for maps
+   * with many optional keys that are usually absent.
+   *
+   * The filter is a bitmap set by the keys as they are added, stored as the
+   * first entry with an empty key and a tagged byte string value that other
+   * decoders ignore.  With one byte per key about 5% of misses still scan
+   * the map.  Counts given to startMap() should include the filter, though
+   * getLength(), forEachParallel() and the std::map getters skip it.
+   *
+   * @param bytes The size of the filter
+   * @return Error kCborErrorState if not at the start of a map
+   */
+  Error addKeyFilter(const uint32_t bytes = 32) noexcept {
+    if (mDepth < 0 || mMapState[mDepth].isArray ||
+        mMapState[mDepth].mapCount != 0 || bytes == 0) {
+      return fail(kCborErrorState);
+    }
+    MapState &state = mMapState[mDepth];
+    state.mapCount++;
+    reserveBytes(1);
+    storeByte(kCborUTF8String << 5);  // empty key
+    encodeTag(kCborTagKeyFilter);
+    encodeHeader(kCborByteString, bytes);
+    reserveBytes(bytes);
+    if (mResult == 0) {
+      memset(mBuf + mDataOffset, 0, bytes);
+      state.filterPos = mDataOffset;
+      state.filterBytes = bytes;
+      mDataOffset += bytes;
+    }
+    return mResult;
+  }
+
+  /**
+   * @brief Start an array with the indicated number of items.  Items are
+   * added with a null name.  As with maps the count is a hint and is
+   * corrected by endArray().
+   *
+   * A homogeneous array is marked with tag 41 to indicate all items have the
+   * same shape, such as a list of records.  If every item also encodes to
+   * the same number of bytes (e.g. maps with the same keys and fixed width
+   * values) decoders can locate items arithmetically.  If the items differ in
+   * size the tag is replaced by a no-op tag in endArray().
+   *
+   * @param name The key name to associate with the array.  Omit if null.
+   * @param numElements The expected number of items
+   * @param homogeneous true to tag the array as homogeneous
+   * @return Error
+   */
+  Error startArray(const char *name, const uint32_t numElements = 0,
+                   const bool homogeneous = false) noexcept {
+    if (name != nullptr && *name != 0) {
+      encodeMapKey(name);
+    }
+    return startContainer(kCborArray, numElements, homogeneous);
+  }
+
+  Error startArray(const uint32_t numElements = 0,
+                   const bool homogeneous = false) noexcept {
+    return startContainer(kCborArray, numElements, homogeneous);
+  }
+
+  /**
+   * @brief Complete array encoding.
+   *
+   * @return Error
+   */
+  Error endArray() noexcept {
+    MapState &list = mMapState[mDepth];
+    if (list.homogeneous) {
+      trackListItem(list, mBufBytesNeeded);
+      if (!list.homogeneous && mResult == 0) {
+        // Items differ in size so replace tag 41 with a no-op tag
+        uint8_t *tag = mBuf + list.mapStartPos - 3;
+        tag[1] = uint8_t(kCborTagSelfDescribed >> 8);
+        tag[2] = uint8_t(kCborTagSelfDescribed);
+      }
+    }
+    return endContainer(kCborArray);
+  }
+  /**
+   * @brief Add an unsigned or signed integer value to the output buffer
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @return Error
+   */
+  template <typename T = uint32_t,
+            typename std::enable_if<(std::is_integral<T>::value &&
+                                     !std::is_same<bool, T>::value)>::type * =
+                nullptr>
+  Error add(const char *name, const T value) noexcept {
+    T intValue = value;
+    encodeMapKey(name);
+    uint8_t tag = kCborPosInt << 5;
+    if (value < 0) {
+      tag = kCborNegInt << 5;
+      intValue = -1 - intValue;
+    }
+
+    if (sizeof(T) == 8) {
+      encodeUInt64(tag | 27, intValue);
+    } else if (sizeof(T) == 4) {
+      encodeUInt32(tag | 26, intValue);
+    } else if (sizeof(T) == 2) {
+      encodeUInt16(tag | 25, intValue);
+    } else {
+      encodeUInt8(tag | 24, intValue);
+    }
+
+    return mResult;
+  }
+
+  /**
+   * @brief Add a boolean value to the output buffer
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @return Error
+   */
+  Error add(const char *name, const bool value) noexcept {
+    encodeMapKey(name);
+    reserveBytes(1);
+    storeByte(value ? kCborTrue : kCborFalse);
+    return mResult;
+  }
+
+  /**
+   * @brief Add a string value to the output buffer
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @return Error
+   */
+  Error add(const char *name, const char *value) noexcept {
+    encodeMapKey(name);
+    encodeString(value, mNullTerminate);
+    return mResult;
+  }
+
+  /**
+   * @brief Add a string value to the output buffer
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @return Error
+   */
+  Error add(const char *name, char *value) noexcept {
+    encodeMapKey(name);
+    encodeString(value, mNullTerminate);
+    return mResult;
+  }
+
+  /**
+   * @brief Add a unsigned or signed integer value to the output buffer
+   *  The value is stored to reduce storage when possible.
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @return Error
+   */
+  template <typename T = uint32_t,
+            typename std::enable_if<(!std::is_same<bool, T>::value)>::type * =
+                nullptr>
+  Error addMinimal(const char *name, const T value) noexcept {
+    encodeMapKey(name);
+    if (value >= 0) {
+      encodeHeader(kCborPosInt, value);
+    } else {
+      encodeHeader(kCborNegInt, -1 - value);
+    }
+    return mResult;
+  }
+
+  /**
+   * @brief Add a float32 value to the output buffer
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @return Error
+   */
+  Error add(const char *name, const float value) noexcept {
+    const void *p = &value;
+
+    encodeMapKey(name);
+    encodeUInt32(kCborFloat32, *(uint32_t *)p);
+    return mResult;
+  }
+
+  /**
+   * @brief Add a float64 value to the output buffer
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @return Error
+   */
+  Error add(const char *name, const double value) noexcept {
+    const void *p = &value;
+    encodeMapKey(name);
+    encodeUInt64(kCborFloat64, *(uint64_t *)p);
+    return mResult;
+  }
+
+  /**
+   * @brief Add an already encoded item, such as a received message, as a
+   * nested value.  The item is checked once against the limits and copied
+   * without being decoded.
+   *
+   * Aligned typed arrays within the item keep their alignment only if the
+   * copy lands at the same offset modulo their size, so readers should use
+   * getPointerChecked().
+   *
+   * @param name The key name to associate with the value.  Omit if null.
+   * @param item The encoded item
+   * @param len The length of the item in bytes
+   * @return Error kCborErrorMalformed if len bytes are not exactly one well
+   * formed item
+   */
+  Error addEncoded(const char *name, const uint8_t *item,
+                   const uint32_t len) noexcept {
+    MicroCbor reader(item, len);
+    reader.mLimits = mLimits;
+    reader.skipField(reader.getNextField());
+    if (reader.getResult() != kCborOk) {
+      return fail(reader.getResult());
+    }
+    if (len == 0 || reader.mDataOffset != len) {
+      return fail(kCborErrorMalformed);
+    }
+    encodeMapKey(name);
+    reserveBytes(len);
+    if (mResult == 0) {
+      memcpy(mBuf + mDataOffset, item, len);
+      mDataOffset += len;
+    }
+    return mResult;
+  }
+
+#ifdef CONFIG_MICROCBOR_THREADS
+  /**
+   * @brief Add a large array, encoding its items on several threads.  The
+   * output is byte for byte the same as
+   *
+   *   startArray(name, n);
+   *   for (uint32_t i = 0; i < n; i++) fn(cbor, i);
+   *   endArray();
+   *
+   * fn(MicroCbor &cbor, uint32_t i) must add item i to cbor with a null
+   * name, depend only on i and be safe to call from several threads.  Items
+   * with aligned typed arrays may be encoded twice, see addChunked().
+   *
+   * @param name The key name to associate with the array.  Omit if null.
+   * @param n The number of items
+   * @param fn Adds an item
+   * @param threads The number of threads, 0 for one per core
+   * @return Error
+   */
+  template <typename Fn>
+  Error addArrayParallel(const char *name, const uint32_t n, Fn fn,
+                         const unsigned threads = 0) {
+    startArray(name, n);
+    addChunked(n, fn, threads);
+    return endArray();
+  }
+
+  /**
+   * @brief Add a large map, encoding its fields on several threads.  As
+   * addArrayParallel() but fn(cbor, i) adds field i with its name.
+   *
+   * @param name The key name to associate with the map.  Omit if null.
+   * @param n The number of fields
+   * @param fn Adds a field
+   * @param threads The number of threads, 0 for one per core
+   * @return Error
+   */
+  template <typename Fn>
+  Error addMapParallel(const char *name, const uint32_t n, Fn fn,
+                       const unsigned threads = 0) {
+    startMap(name, n);
+    addChunked(n, fn, threads);
+    return endMap();
+  }
+#endif
+
+  /**
+   * @brief Add a value of an application type with a MicroCborCodec
+   * specialization to the output buffer.
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @return Error
+   */
+  template <typename T, typename std::enable_if<
+                            (kCborHasCodec<T>::value)>::type * = nullptr>
+  Error add(const char *name, const T &value) {
+    encodeMapKey(name);
+    if (MicroCborCodec<T>::tag != kCborTagInvalid) {
+      encodeTag(MicroCborCodec<T>::tag);
+    }
+    if (mDepth < 0) {
+      MicroCborCodec<T>::encode(*this, value);
+      return mResult;
+    }
+    // The item has been counted so do not count the codec's item again, but
+    // keep the alignment of any arrays within it
+    const MapState parent = mMapState[mDepth];
+    MicroCborCodec<T>::encode(*this, value);
+    MapState &state = mMapState[mDepth];
+    state.mapCount = parent.mapCount;
+    state.itemStart = parent.itemStart;
+    state.itemSize = parent.itemSize;
+    state.homogeneous = parent.homogeneous;
+    return mResult;
+  }
+
+  /**
+   * @brief Add an arbitrary precision integer (bignum) to the output buffer
+   * using tag 2, or tag 3 for negative values.
+   *
+   * @param name The key name to associate with the value
+   * @param magnitude The big-endian magnitude.  For negative values the
+   * value is -1 - magnitude as specified by RFC 8949.
+   * @param length The number of bytes in magnitude
+   * @param negative true for a negative value
+   * @return Error
+   */
+  Error addBignum(const char *name, const uint8_t *magnitude,
+                  const uint32_t length, const bool negative = false) noexcept {
+    encodeMapKey(name);
+    encodeTag(negative ? kCborTagNegativeBignum : kCborTagPositiveBignum);
+    encodeBytes(magnitude, length);
+    return mResult;
+  }
+
+#ifdef __SIZEOF_INT128__
+  /**
+   * @brief Add an unsigned 128 bit integer to the output buffer.  Values that
+   * fit in 64 bits are stored as integers, larger values as bignums.
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @return Error
+   */
+  Error add(const char *name, const unsigned __int128 value) noexcept {
+    encodeMapKey(name);
+    encodeInt128(false, value);
+    return mResult;
+  }
+
+  /**
+   * @brief Add a signed 128 bit integer to the output buffer.  Values that
+   * fit in 64 bits are stored as integers, larger values as bignums.
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @return Error
+   */
+  Error add(const char *name, const __int128 value) noexcept {
+    encodeMapKey(name);
+    if (value < 0) {
+      encodeInt128(true, (unsigned __int128)(-1 - value));
+    } else {
+      encodeInt128(false, (unsigned __int128)value);
+    }
+    return mResult;
+  }
+#endif
+
+  /**
+   * @brief Add an array of data to the output buffer
+   *
+   * Named arrays are aligned on a sizeof(T) boundary by padding the key.
+   * Unnamed arrays, such as array items, are not aligned so no padding tags
+   * are added to them; use addAligned() to align them.
+   *
+   * @param name The key name to associate with the value.  Omit if null.
+   * @param value The value to store
+   * @param numElements The number of elements in value
+   * @param align true to align the data of a named array
+   * @return Error
+   */
+  template <typename T>
+  Error add(const char *name, const T *value, const uint32_t numElements,
+            const bool align = true) {
+    const bool named = name != nullptr && *name != 0;
+    return addAligned(name, value, numElements,
+                      align && named ? sizeof(T) : 1);
+  }
+
+  /**
+   * @brief Add an array of data to the output buffer with the array data
+   * aligned on an arbitrary boundary, e.g. 64 for cache lines or AVX-512 and
+   * 4096 for DMA.
+   *
+   * Alignment is relative to the start of the buffer so the buffer itself
+   * must be at least as aligned for the data address to be aligned.  Named
+   * arrays pad the key.  Unnamed arrays are preceded by no-op tags.
+   *
+   * @param name The key name to associate with the value.  Omit if null.
+   * @param value The value to store
+   * @param numElements The number of elements in value
+   * @param alignment The alignment in bytes, a power of 2.  1 for none.
+   * @return Error
+   */
+  template <typename T>
+  Error addAligned(const char *name, const T *value,
+                   const uint32_t numElements, const uint32_t alignment) {
+    const auto numRawBytes = numElements * sizeof(T);
+    encodeAlignedKey(name, 2 /*tag*/ + bytesForLength(numRawBytes), alignment);
+    encodeTag(kCborTagInfo<T>::tag);
+    encodeBytes(value, numRawBytes);
+    return mResult;
+  }
+
+  /**
+   * @brief Add a typed array gathered from elements spaced strideBytes
+   * apart, such as one field of an array of structs, without a staging copy.
+   * Alignment is as for add(name, const T*, n, align), so the output is the
+   * same as adding the elements from a contiguous array.
+   *
+   * @code
+   *   cbor.addStrided("x", &samples[0].pos.x, sizeof(Sample), numSamples);
+   * @endcode
+   *
+   * @param name The key name to associate with the value.  Omit if null.
+   * @param value The first element
+   * @param strideBytes The distance in bytes between elements
+   * @param numElements The number of elements
+   * @param align true to align the data on a sizeof(T) boundary
+   * @return Error
+   */
+  template <typename T>
+  Error addStrided(const char *name, const T *value, const size_t strideBytes,
+                   const uint32_t numElements, const bool align = true) {
+    if (strideBytes == sizeof(T)) {
+      return add(name, value, numElements, align);
+    }
+    const bool named = name != nullptr && *name != 0;
+    uint8_t *out = encodeTypedArray<T>(name, numElements, align && named);
+    if (out != nullptr) {
+      const uint8_t *in = (const uint8_t *)value;
+      // fixed size copies compile to plain loads and stores
+      for (uint32_t i = 0; i < numElements; i++) {
+        memcpy(out + i * sizeof(T), in + i * strideBytes, sizeof(T));
+      }
+    }
+    return mResult;
+  }
+
+  /**
+   * @brief Add a typed array gathered from value[indices[0]],
+   * value[indices[1]], ...  Alignment is as for add(name, const T*, n,
+   * align).
+   *
+   * @param name The key name to associate with the value.  Omit if null.
+   * @param value The elements to gather from
+   * @param indices The index of each element to add
+   * @param numElements The number of indices
+   * @param align true to align the data on a sizeof(T) boundary
+   * @return Error
+   */
+  template <typename T>
+  Error addGathered(const char *name, const T *value, const uint32_t *indices,
+                    const uint32_t numElements, const bool align = true) {
+    const bool named = name != nullptr && *name != 0;
+    uint8_t *out = encodeTypedArray<T>(name, numElements, align && named);
+    if (out != nullptr) {
+      for (uint32_t i = 0; i < numElements; i++) {
+        memcpy(out + i * sizeof(T), value + indices[i], sizeof(T));
+      }
+    }
+    return mResult;
+  }
+
+  /**
+   * @brief Add the elements of an iterator range without copying them to a
+   * temporary first, e.g. a filtered view or a ring buffer span.
+   *
+   * Numeric elements are stored as a typed array and other elements as an
+   * array, as for std::vector.  For forward iterators the distance sizes the
+   * header up front.  Single pass input iterators are streamed with the
+   * header written once the length is known.
+   *
+   * @param name The key name to associate with the value.  Omit if null.
+   * @param first The first element
+   * @param last One past the last element
+   * @param align true to align typed array data on a sizeof(T) boundary
+   * @return Error
+   */
+  template <typename It>
+  Error addRange(const char *name, It first, It last, const bool align = true) {
+    using T = typename std::iterator_traits<It>::value_type;
+    using Category = typename std::iterator_traits<It>::iterator_category;
+    if (std::is_base_of<std::forward_iterator_tag, Category>::value) {
+      return addCounted<T>(name, first, std::distance(first, last), align);
+    }
+    return addGenerated<T>(
+        name,
+        [&first, &last](T &value) {
+          if (first == last) {
+            return false;
+          }
+          value = *first;
+          ++first;
+          return true;
+        },
+        align);
+  }
+
+  /**
+   * @brief Add elements produced by a generator until it reports the end.
+   *
+   * The number of elements is not needed up front.  Typed arrays are written
+   * with a 4 byte length that is filled in at the end so alignment does not
+   * depend on the length.  Arrays have their count corrected by endArray().
+   *
+   * @param name The key name to associate with the value.  Omit if null.
+   * @param next Called as bool next(T &value).  Sets value and returns true,
+   * or returns false when there are no more elements.
+   * @param align true to align typed array data on a sizeof(T) boundary
+   * @return Error
+   */
+  template <typename T, typename Gen,
+            typename std::enable_if<(kCborHasTagInfo<T>::value)>::type * =
+                nullptr>
+  Error addGenerated(const char *name, Gen next, const bool align = true) {
+    encodeAlignedKey(name, 2 /*tag*/ + 5, align ? sizeof(T) : 1);
+    encodeTag(kCborTagInfo<T>::tag);
+    const uint32_t headerPos = mDataOffset;
+    reserveBytes(5);
+    if (mResult == 0) {
+      mDataOffset += 5;
+    }
+    uint32_t numRawBytes = 0;
+    T value;
+    while (next(value)) {
+      reserveBytes(sizeof(T));
+      if (mResult == 0) {
+        memcpy(mBuf + mDataOffset, &value, sizeof(T));
+        mDataOffset += sizeof(T);
+      }
+      numRawBytes += sizeof(T);
+    }
+    if (mResult == 0) {
+      storeHeader(mBuf + headerPos, kCborByteString, numRawBytes, 5);
+    }
+    return mResult;
+  }
+
+  template <typename T, typename Gen,
+            typename std::enable_if<(!kCborHasTagInfo<T>::value)>::type * =
+                nullptr>
+  Error addGenerated(const char *name, Gen next, const bool align = true) {
+    startArray(name);
+    T value;
+    while (next(value)) {
+      add(nullptr, value);
+    }
+    return endArray();
+  }
+
+  /**
+   * @brief Add a multi-dimensional array (RFC 8746) to the output buffer.
+   *
+   * The elements are encoded as a typed array wrapped in tag 40 (row-major)
+   * or tag 1040 (column-major) together with the dimensions.  The element
+   * data is aligned on a sizeof(T) boundary so it can be used in place when
+   * decoding with getTensor().
+   *
+   * @param name The key name to associate with the value.  Omit if null.
+   * @param value The elements, stored in the order given by columnMajor
+   * @param dims The size of each dimension
+   * @param numDims The number of dimensions
+   * @param columnMajor true if the first dimension varies fastest
+   * @param align true to align the element data on a sizeof(T) boundary
+   * @return Error
+   */
+  template <typename T>
+  Error addTensor(const char *name, const T *value, const uint32_t *dims,
+                  const uint8_t numDims, const bool columnMajor = false,
+                  const bool align = true) {
+    return addTensor(name, value, dims, numDims, nullptr, columnMajor, align);
+  }
+
+  /**
+   * @brief Add a multi-dimensional array gathered from strided memory.
+   *
+   * Elements are read from value[i0 * strides[0] + i1 * strides[1] + ...]
+   * and written straight into the output buffer in the order given by
+   * columnMajor, so non-contiguous sources (sub-images, transposed views)
+   * need no staging copy.
+   *
+   * @param name The key name to associate with the value.  Omit if null.
+   * @param value The first element of the source
+   * @param dims The size of each dimension
+   * @param numDims The number of dimensions
+   * @param strides The source stride of each dimension in elements.  If null
+   * the source is contiguous in the encoded order.
+   * @param columnMajor true if the first dimension varies fastest
+   * @param align true to align the element data on a sizeof(T) boundary
+   * @return Error
+   */
+  template <typename T>
+  Error addTensor(const char *name, const T *value, const uint32_t *dims,
+                  const uint8_t numDims, const uint32_t *strides,
+                  const bool columnMajor, const bool align = true) {
+    if (numDims > CONFIG_MICROCBOR_MAX_TENSOR_DIMS) {
+      return fail(kCborErrorUnsupported);
+    }
+    uint64_t numElements = 1;
+    uint32_t dimBytes = bytesForLength(numDims);
+    for (uint8_t d = 0; d < numDims; d++) {
+      numElements *= dims[d];
+      if (numElements > UINT32_MAX / sizeof(T)) {
+        return fail(kCborErrorUnsupported);
+      }
+      dimBytes += bytesForLength(dims[d]);
+    }
+    const uint32_t numRawBytes = uint32_t(numElements * sizeof(T));
+    const uint16_t tensorTag =
+        columnMajor ? kCborTagMultiDimArrayColumnMajor : kCborTagMultiDimArray;
+
+    if (align) {
+      encodeAlignedKey(name,
+                       (columnMajor ? 3 : 2) + 1 /*array*/ + dimBytes +
+                           2 /*tag*/ + bytesForLength(numRawBytes),
+                       sizeof(T));
+    } else {
+      encodeMapKey(name);
+    }
+    encodeTag(tensorTag);
+    encodeHeader(kCborArray, 2);
+    encodeHeader(kCborArray, numDims);
+    for (uint8_t d = 0; d < numDims; d++) {
+      encodeHeader(kCborPosInt, dims[d]);
+    }
+    encodeTag(kCborTagInfo<T>::tag);
+    if (strides == nullptr) {
+      encodeBytes(value, numRawBytes);
+      return mResult;
+    }
+
+    encodeHeader(kCborByteString, numRawBytes);
+    reserveBytes(numRawBytes);
+    if (mResult == 0 && numElements != 0) {
+      encodeStrided(mBuf + mDataOffset, value, dims, numDims, strides,
+                    columnMajor);
+      mDataOffset += numRawBytes;
+    }
+    return mResult;
+  }
+
+  /**
+   * @brief Add an enum value to the output buffer as an integer using the
+   * fewest bytes.
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @return Error
+   */
+  template <typename T, typename std::enable_if<
+                            (std::is_enum<T>::value)>::type * = nullptr>
+  Error add(const char *name, const T value) noexcept {
+    encodeMapKey(name);
+    encodeInteger(int64_t(typename std::underlying_type<T>::type(value)));
+    return mResult;
+  }
+
+#if __cplusplus >= 201703L
+  /**
+   * @brief Add an optional value to the output buffer.
+   *
+   * An empty optional is omitted unless emitNull is true, in which case null
+   * is stored.  Use emitNull for list items so item positions are kept.
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @param emitNull true to store null for an empty optional
+   * @return Error
+   */
+  template <typename T>
+  Error add(const char *name, const std::optional<T> &value,
+            const bool emitNull = false) {
+    if (value.has_value()) {
+      return add(name, *value);
+    }
+    if (emitNull) {
+      encodeMapKey(name);
+      reserveBytes(1);
+      storeByte(kCborNull);
+    }
+    return mResult;
+  }
+
+  /**
+   * @brief Add a variant to the output buffer.
+   *
+   * The active alternative is stored as it would be by add(), wrapped in
+   * tag kCborTagVariant plus the alternative index so get() knows the
+   * alternative even when several have the same encoding, e.g. int32_t and
+   * uint32_t or an enum and its underlying type.
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @return Error kCborErrorState if the variant is valueless
+   */
+  template <typename... Ts>
+  Error add(const char *name, const std::variant<Ts...> &value) {
+    static_assert(sizeof...(Ts) <= kCborMaxVariantAlternatives,
+                  "too many variant alternatives");
+    if (value.valueless_by_exception()) {
+      return fail(kCborErrorState);
+    }
+    if (name != nullptr && *name != 0) {
+      encodeMapKey(name);
+    }
+    encodeTag(uint16_t(kCborTagVariant + value.index()));
+    return std::visit([&](const auto &v) { return add(nullptr, v); }, value);
+  }
+#endif
+
+#ifdef CONFIG_MICROCBOR_STD_CHRONO
+  /**
+   * @brief Add a time point to the output buffer.
+   *
+   * A std::chrono::system_clock time is stored compactly as tag 1 with an
+   * integer for whole seconds, or as a tag 1001 map otherwise.  With
+   * fixedWidth a tag 1001 map with 64 bit seconds and 32 bit nanoseconds is
+   * always used so the value can be patched in place.  The epochs of other
+   * clocks, such as steady_clock, are not the Unix epoch so their time since
+   * the epoch is stored as a tag 1002 duration.
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @param fixedWidth true to always encode the same number of bytes
+   * @return Error
+   */
+  template <typename Clock, typename Duration>
+  Error add(const char *name,
+            const std::chrono::time_point<Clock, Duration> &value,
+            const bool fixedWidth = false) noexcept {
+    encodeMapKey(name);
+    encodeTime(timeTag<Clock>(), value.time_since_epoch(), fixedWidth);
+    return mResult;
+  }
+
+  /**
+   * @brief Add a duration to the output buffer as a tag 1002 map.
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @param fixedWidth true to always encode the same number of bytes
+   * @return Error
+   */
+  template <typename Rep, typename Period>
+  Error add(const char *name, const std::chrono::duration<Rep, Period> &value,
+            const bool fixedWidth = false) noexcept {
+    encodeMapKey(name);
+    encodeTime(kCborTagDurationExt, value, fixedWidth);
+    return mResult;
+  }
+#endif
+
+#ifdef CONFIG_MICROCBOR_STD_VECTOR
+  /**
+   * @brief Add a std::vector<numeric> value to the output buffer
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @return Error
+   */
+  template <typename T, typename std::enable_if<
+                            (kCborHasTagInfo<T>::value)>::type * = nullptr>
+  inline Error add(const char *name, const std::vector<T> &value,
+                   const bool align = true) noexcept {
+    return add(name, value.data(), value.size(), align);
+  }
+
+  /**
+   * @brief Add a std::vector of non-numeric items, such as strings or
+   * application types, to the output buffer as an array.
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @return Error
+   */
+  template <typename T, typename std::enable_if<
+                            (!kCborHasTagInfo<T>::value)>::type * = nullptr>
+  Error add(const char *name, const std::vector<T> &value) {
+    startArray(name, value.size());
+    for (const T &item : value) {
+      add(nullptr, item);
+    }
+    return endArray();
+  }
+#endif
+
+#ifdef CONFIG_MICROCBOR_STD_CONTAINERS
+  /**
+   * @brief Add a std::string value to the output buffer
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @return Error
+   */
+  Error add(const char *name, const std::string &value) noexcept {
+    encodeMapKey(name);
+    encodeString(value.c_str(), value.size(), mNullTerminate);
+    return mResult;
+  }
+
+  /**
+   * @brief Add a std::array to the output buffer.  Numeric values are stored
+   * as a typed array, other values as an array.
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @return Error
+   */
+  template <typename T, size_t N>
+  Error add(const char *name, const std::array<T, N> &value,
+            const bool align = true) {
+    return addItems(name, value.data(), N, align);
+  }
+
+  /**
+   * @brief Add a std::map with string keys to the output buffer as a map.
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @return Error
+   */
+  template <typename V, typename C, typename A>
+  Error add(const char *name, const std::map<std::string, V, C, A> &value) {
+    return addPairs(name, value);
+  }
+
+  /**
+   * @brief Add a std::unordered_map with string keys to the output buffer as
+   * a map.
+   *
+   * @param name The key name to associate with the value
+   * @param value The value to store
+   * @return Error
+   */
+  template <typename V, typename H, typename E, typename A>
+  Error add(const char *name,
+            const std::unordered_map<std::string, V, H, E, A> &value) {
+    return addPairs(name, value);
+  }
+#endif
+
+  /**
+   * @brief Get a map element with the specified key name.
+   * If the key name is not present or is not a map an empty MicroCbor instance
+   * is returned.
+   *
+   * @param name The key name to look up.
+   * @return A MicroCbor instance suitable for reading values from the map.
+   */
+  MicroCbor getMap(const char *name) {
+    auto element = findElement(name);
+    if (element.majorval == kCborMap) {
+      return readerAt(element.p);
+    } else {
+      return MicroCbor();
+    }
+  }
+
+  /**
+   * @brief Access to the items of an array.
+   *
+   * Each item is returned as a MicroCbor instance positioned on the item.
+   * Use a null name to read a scalar item, e.g. item.get(nullptr, 0), or
+   * named lookups when the item is a map.
+   */
+  class CborList {
+    friend class MicroCbor;
+    const uint8_t *mFirst = nullptr;  //< The first item
+    uint32_t mMaxLen = 0;             //< Bytes available from mFirst
+    uint32_t mStride = 0;  //< Bytes per item if homogeneous, otherwise 0
+    bool mValidateUtf8 = false;
+    MicroCborLimits mLimits;
+
+   public:
+    uint32_t length = 0;  //< The number of items
+
+    /**
+     * @brief true if the array was tagged homogeneous by an encoder that
+     * checked its items are the same size, so items can be located without
+     * walking the preceding items.
+     */
+    bool homogeneous() const noexcept { return mStride != 0; }
+
+    /**
+     * @brief Get the item at the given index.
+     *
+     * For homogeneous arrays the item is located arithmetically.  Otherwise
+     * the preceding items are skipped.
+     *
+     * @param index The item index
+     * @return A MicroCbor instance positioned on the item, or an empty
+     * instance if the index is out of range.
+     */
+    MicroCbor at(const uint32_t index) const noexcept {
+      if (index >= length) {
+        return MicroCbor();
+      }
+      uint64_t offset = uint64_t(index) * mStride;
+      if (mStride == 0 || offset + mStride > mMaxLen) {
+        MicroCbor reader(mFirst, mMaxLen);
+        reader.mLimits = mLimits;
+        for (uint32_t i = 0; i < index && reader.mResult == kCborOk; i++) {
+          reader.skipField(reader.getNextField());
+        }
+        offset = reader.mDataOffset;
+        if (offset >= mMaxLen) {
+          return MicroCbor();
+        }
+      }
+      MicroCbor item(mFirst + offset, mMaxLen - uint32_t(offset));
+      item.mValidateUtf8 = mValidateUtf8;
+      item.mLimits = mLimits;
+      return item;
+    }
+  };
+
+  /**
+   * @brief Get an array with the specified key name.
+   * If the key name is not present or is not an array an empty list is
+   * returned.
+   *
+   * @param name The key name to look up.
+   * @return CborList
+   */
+  CborList getArray(const char *name) noexcept {
+    CborList list;
+    auto element = findElement(name);
+    if (element.majorval != kCborArray) {
+      return list;
+    }
+    const uint32_t start = uint32_t(element.p - mBuf) + element.headerBytes;
+    if (start > mMaxBufLen) {
+      return list;
+    }
+    list.mFirst = element.p + element.headerBytes;
+    list.mMaxLen = mMaxBufLen - start;
+    // each item takes at least a byte, so corrupt counts are bounded
+    list.length = getFieldValue(element);
+    if (list.length > list.mMaxLen) {
+      list.length = list.mMaxLen;
+    }
+    list.mValidateUtf8 = mValidateUtf8;
+    list.mLimits = mLimits;
+    // Tag 41 only means the items have the same type.  endArray() writes it
+    // in the 3 byte form, kept only if the items are also the same size.
+    const uint8_t *tag = element.p - 3;
+    if (element.tag == kCborTagHomogeneousArray && list.length > 1 &&
+        tag >= element.start && tag[0] == (kCborTag << 5 | 25) &&
+        tag[1] == 0 && tag[2] == kCborTagHomogeneousArray) {
+      MicroCbor reader(list.mFirst, list.mMaxLen);
+      reader.skipField(reader.getNextField());
+      if (reader.mResult == kCborOk && reader.mDataOffset != 0) {
+        list.mStride = reader.mDataOffset;
+        if (list.length > list.mMaxLen / list.mStride) {
+          list.length = list.mMaxLen / list.mStride;
+        }
+      }
+    }
+    return list;
+  }
+
+#ifdef CONFIG_MICROCBOR_THREADS
+  /**
+   * @brief Visit the items of a large array, or the values of a large map,
+   * on several threads.
+   *
+   * The items are located in one sequential pass that only reads headers
+   * and skips the contents, building an index of item offsets.  Worker
+   * threads then take small chunks of items in turn, so items of uneven
+   * cost are balanced across threads.  If fn throws, the remaining items are
+   * skipped and the first exception is rethrown once all workers finish.
+   *
+   * @param name The key name of the array or map, null for the current item
+   * @param fn Called as fn(MicroCbor &item, uint32_t index) with a read-only
+   * instance positioned on the item, from several threads at once
+   * @param threads The number of threads, 0 for one per core
+   * @return Error kCborErrorNotFound, kCborErrorWrongType if the field is not
+   * an array or map, or the error found while locating the items
+   */
+  template <typename Fn>
+  Error forEachParallel(const char *name, Fn fn, unsigned threads = 0) {
+    const auto info = findElement(name);
+    if (info.majorval == kCborError) {
+      return kCborErrorNotFound;
+    }
+    if (info.majorval != kCborArray && info.majorval != kCborMap) {
+      return kCborErrorWrongType;
+    }
+    uint32_t n = itemCount(info);
+    auto reader = readerAt(info.p);
+    reader.mDataOffset += info.headerBytes;
+    if (info.majorval == kCborMap && n > 0 && reader.skipKeyFilter()) {
+      n--;
+    }
+    std::vector<uint32_t> items;
+    items.reserve(n);
+    for (uint32_t i = 0; i < n; i++) {
+      if (info.majorval == kCborMap) {
+        reader.skipField(reader.getNextField());  // key
+      }
+      const auto item = reader.getNextField();
+      if (item.majorval == kCborError) {
+        return fail(kCborErrorMalformed);
+      }
+      items.push_back(uint32_t(item.start - mBuf));
+      reader.skipField(item);
+    }
+    if (reader.getResult() != kCborOk) {
+      return fail(reader.getResult());
+    }
+
+    if (threads == 0) {
+      threads = std::thread::hardware_concurrency();
+    }
+    threads = threads == 0 ? 1 : threads > n ? n : threads;
+    const uint64_t chunk = n / (uint64_t(threads) * 16) + 1;
+    std::atomic<uint64_t> next(0);
+    std::exception_ptr exception;  // the first thrown by fn
+    std::mutex exceptionLock;
+    const auto worker = [&]() {
+      for (uint64_t first = next.fetch_add(chunk); first < n;
+           first = next.fetch_add(chunk)) {
+        const uint64_t last = first + chunk < n ? first + chunk : n;
+        try {
+          for (uint64_t i = first; i < last; i++) {
+            auto item = readerAt(mBuf + items[i]);
+            fn(item, uint32_t(i));
+          }
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(exceptionLock);
+          if (!exception) {
+            exception = std::current_exception();
+          }
+          next = n;  // skip the remaining items
+        }
+      }
+    };
+    std::vector<std::thread> workers;
+    try {
+      for (unsigned t = 1; t < threads; t++) {
+        workers.emplace_back(worker);
+      }
+    } catch (const std::system_error &) {
+      // continue with the workers started, this thread takes the rest
+    }
+    worker();
+    for (auto &t : workers) {
+      t.join();
+    }
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+    return kCborOk;
+  }
+#endif
+
+  /**
+   * @brief Get an unsigned or signed integer value with the specified key name.
+   * If the value is not present, the default value is returned.
+   *
+   * @param name The key name to look up.
+   * @return The value in the map or the defaultValue.
+   */
+  template <typename T,
+            typename std::enable_if<
+                (std::is_integral<T>::value && !std::is_same<bool, T>::value &&
+                 !std::is_same<float, T>::value &&
+                 !kCborIsInt128<T>::value)>::type * = nullptr>
+  T get(const char *name, const T defaultValue) noexcept {
+    auto element = findElement(name);
+    const auto value = getFieldValue<uint64_t>(element);
+    if (element.majorval == kCborPosInt) {
+      return T(value);
+    }
+    if (element.majorval == kCborNegInt) {
+      return T(-value - 1);
+    }
+    return defaultValue;
+  }
+
+  /**
+   * @brief Get a boolean value with the specified key name.  If the value is
+   * not present, the default value is returned.
+   *
+   * @param name The key name to look up.
+   * @return The value in the map or the defaultValue.
+   * @return bool
+   */
+  template <typename T, typename std::enable_if<
+                            (std::is_same<bool, T>::value)>::type * = nullptr>
+  T get(const char *name, const T defaultValue) noexcept {
+    auto element = findElement(name);
+
+    if (element.majorval == kCborSimple) {
+      if (element.minorval == 20) {
+        return false;
+      } else if (element.minorval == 21) {
+        return true;
+      } else {
+        return defaultValue;
+      }
+    }
+
+    return defaultValue;
+  }
+
+  /**
+   * @brief Get a float value with the specified key name.  If the value is
+   * not present, the default value is returned.
+   *
+   * @param name The key name to look up.
+   * @return The value in the map or the defaultValue.
+   * @return float
+   */
+  template <typename T, typename std::enable_if<
+                            (std::is_same<float, T>::value)>::type * = nullptr>
+  T get(const char *name, const T defaultValue) noexcept {
+    auto element = findElement(name);
+
+    if (element.majorval == kCborSimple) {
+      if (element.minorval == 26) {
+        uint32_t f = getFieldValue(element);
+        return *(float *)&f;
+      } else {
+        return defaultValue;
+      }
+    }
+
+    return defaultValue;
+  }
+
+  /**
+   * @brief Get a double value with the specified key name.  Both float32 and
+   * float64 values are accepted.  If the value is not present, the default
+   * value is returned.
+   *
+   * @param name The key name to look up.
+   * @return The value in the map or the defaultValue.
+   */
+  template <typename T, typename std::enable_if<
+                            (std::is_same<double, T>::value)>::type * = nullptr>
+  T get(const char *name, const T defaultValue) noexcept {
+    double value;
+    return readFloat(findElement(name), value) ? value : defaultValue;
+  }
+
+  /**
+   * @brief Get an enum value with the specified key name.  If the value is
+   * not present, the default value is returned.
+   *
+   * @param name The key name to look up.
+   * @return The value in the map or the defaultValue.
+   */
+  template <typename T, typename std::enable_if<
+                            (std::is_enum<T>::value)>::type * = nullptr>
+  T get(const char *name, const T defaultValue) noexcept {
+    int64_t value;
+    if (!readInteger(findElement(name), value)) {
+      return defaultValue;
+    }
+    return T(typename std::underlying_type<T>::type(value));
+  }
+
+#if __cplusplus >= 201703L
+  /**
+   * @brief Get an optional value with the specified key name.
+   *
+   * If the value is null an empty optional is returned.  If the value is not
+   * present or is not a T, the default value is returned.
+   *
+   * @param name The key name to look up.
+   * @return The value in the map or the defaultValue.
+   */
+  template <typename T>
+  std::optional<T> get(const char *name,
+                       const std::optional<T> defaultValue) {
+    auto element = findElement(name);
+    if (element.majorval == kCborSimple && element.minorval == 22) {
+      return std::nullopt;
+    }
+    if (!matchesType<T>(element, false)) {
+      return defaultValue;
+    }
+    return readerAt(element.start).get(nullptr, T{});
+  }
+
+  /**
+   * @brief Get a variant with the specified key name.
+   *
+   * Variants stored by add() are tagged with the alternative index.  For
+   * untagged values from other encoders the first alternative encoded
+   * exactly as add() would store it is returned, otherwise the first
+   * alternative able to hold the value.  If the value is not present or
+   * does not match, the default value is returned.
+   *
+   * @param name The key name to look up.
+   * @return The value in the map or the defaultValue.
+   */
+  template <typename... Ts>
+  std::variant<Ts...> get(const char *name,
+                          const std::variant<Ts...> defaultValue) {
+    auto element = findElement(name);
+    std::variant<Ts...> value = defaultValue;
+    if (element.tag >= kCborTagVariant &&
+        element.tag < kCborTagVariant + kCborMaxVariantAlternatives) {
+      const auto inner = readerAt(element.content).findElement(nullptr);
+      return getAlternativeAt<0>(inner, element.tag - kCborTagVariant, value)
+                 ? value
+                 : defaultValue;
+    }
+    if (element.majorval != kCborError &&
+        (getAlternative<0>(element, true, value) ||
+         getAlternative<0>(element, false, value))) {
+      return value;
+    }
+    return defaultValue;
+  }
+#endif
+
+#ifdef CONFIG_MICROCBOR_STD_CHRONO
+  /**
+   * @brief Get a time point with the specified key name.  For
+   * std::chrono::system_clock tag 1 integer or float times and tag 1001 maps
+   * are accepted, and for other clocks tag 1002 durations.  If the value is
+   * not present or out of range, the default value is returned.
+   *
+   * @param name The key name to look up.
+   * @return The value in the map or the defaultValue.
+   */
+  template <typename Clock, typename Duration>
+  std::chrono::time_point<Clock, Duration> get(
+      const char *name,
+      const std::chrono::time_point<Clock, Duration> defaultValue) noexcept {
+    std::chrono::nanoseconds value;
+    if (!decodeTime(findElement(name), timeTag<Clock>(), value)) {
+      return defaultValue;
+    }
+    return std::chrono::time_point<Clock, Duration>(
+        std::chrono::duration_cast<Duration>(value));
+  }
+
+  /**
+   * @brief Get a duration with the specified key name.  If the value is not
+   * present, the default value is returned.
+   *
+   * @param name The key name to look up.
+   * @return The value in the map or the defaultValue.
+   */
+  template <typename Rep, typename Period>
+  std::chrono::duration<Rep, Period> get(
+      const char *name,
+      const std::chrono::duration<Rep, Period> defaultValue) noexcept {
+    std::chrono::nanoseconds value;
+    if (!decodeTime(findElement(name), kCborTagDurationExt, value)) {
+      return defaultValue;
+    }
+    return std::chrono::duration_cast<std::chrono::duration<Rep, Period>>(
+        value);
+  }
+#endif
+
+  /**
+   * @brief Get a value of an application type with a MicroCborCodec
+   * specialization.  If the value is not present, has a different tag or
+   * the codec fails, the default value is returned.
+   *
+   * @param name The key name to look up.
+   * @return The value in the map or the defaultValue.
+   */
+  template <typename T, typename std::enable_if<
+                            (kCborHasCodec<T>::value)>::type * = nullptr>
+  T get(const char *name, const T defaultValue) {
+    auto element = findElement(name);
+    if (element.majorval == kCborError) {
+      return defaultValue;
+    }
+    uint8_t *item = element.start;
+    if (MicroCborCodec<T>::tag != kCborTagInvalid) {
+      if (element.tag != MicroCborCodec<T>::tag) {
+        return defaultValue;
+      }
+      item = element.content;
+    }
+    auto reader = readerAt(item);
+    T value = defaultValue;
+    if (!MicroCborCodec<T>::decode(reader, value)) {
+      return defaultValue;
+    }
+    return value;
+  }
+
+#ifdef CONFIG_MICROCBOR_STD_VECTOR
+  /**
+   * @brief Get a std::vector with the specified key name from a typed array
+   * or an array.  If the value is not present, the default value is
+   * returned.
+   *
+   * @param name The key name to look up.
+   * @return The value in the map or the defaultValue.
+   */
+  template <typename T>
+  std::vector<T> get(const char *name, const std::vector<T> &defaultValue) {
+    auto element = findElement(name);
+    std::vector<T> value;
+    if (getTypedItems(element, value)) {
+      return value;
+    }
+    if (element.majorval != kCborArray) {
+      return defaultValue;
+    }
+    value.reserve(itemCount(element));
+    forEachItem(element, [&](MicroCbor &item) {
+      value.push_back(item.get(nullptr, T{}));
+    });
+    return value;
+  }
+#endif
+
+#ifdef CONFIG_MICROCBOR_STD_CONTAINERS
+  /**
+   * @brief Get a std::string value with the specified key name.  If the value
+   * is not present, the default value is returned.
+   *
+   * @param name The key name to look up.
+   * @return The value in the map or the defaultValue.
+   */
+  std::string get(const char *name, const std::string &defaultValue) {
+    auto element = findElement(name);
+    if (element.majorval != kCborUTF8String || !isValidString(element)) {
+      return defaultValue;
+    }
+    const char *s = (const char *)(element.p + element.headerBytes);
+    auto len = getFieldValue(element);
+    if (len > 0 && s[len - 1] == 0) {
+      // do not include the attached null byte
+      len--;
+    }
+    return std::string(s, len);
+  }
+
+  /**
+   * @brief Get a std::array with the specified key name.  If the value is
+   * not present or does not have N items, the default value is returned.
+   *
+   * @param name The key name to look up.
+   * @return The value in the map or the defaultValue.
+   */
+  template <typename T, size_t N>
+  std::array<T, N> get(const char *name,
+                       const std::array<T, N> &defaultValue) {
+    auto element = findElement(name);
+    std::array<T, N> value;
+    if (getTypedItems(element, value.data(), N)) {
+      return value;
+    }
+    if (element.majorval != kCborArray || getFieldValue(element) != N) {
+      return defaultValue;
+    }
+    size_t i = 0;
+    forEachItem(element,
+                [&](MicroCbor &item) { value[i++] = item.get(nullptr, T{}); });
+    return value;
+  }
+
+  /**
+   * @brief Get a std::map with the specified key name.  If the value is not
+   * present or is not a map, the default value is returned.
+   *
+   * @param name The key name to look up.
+   * @return The value in the map or the defaultValue.
+   */
+  template <typename V, typename C, typename A>
+  std::map<std::string, V, C, A> get(
+      const char *name, const std::map<std::string, V, C, A> &defaultValue) {
+    std::map<std::string, V, C, A> value;
+    return getPairs(findElement(name), value) ? value : defaultValue;
+  }
+
+  /**
+   * @brief Get a std::unordered_map with the specified key name.  If the
+   * value is not present or is not a map, the default value is returned.
+   *
+   * @param name The key name to look up.
+   * @return The value in the map or the defaultValue.
+   */
+  template <typename V, typename H, typename E, typename A>
+  std::unordered_map<std::string, V, H, E, A> get(
+      const char *name,
+      const std::unordered_map<std::string, V, H, E, A> &defaultValue) {
+    std::unordered_map<std::string, V, H, E, A> value;
+    auto element = findElement(name);
+    if (element.majorval == kCborMap) {
+      value.reserve(itemCount(element));
+    }
+    return getPairs(element, value) ? value : defaultValue;
+  }
+#endif
+
+  struct CborBignum {
+    size_t length;  //< The number of magnitude bytes
+    const uint8_t *p;  //< The big-endian magnitude without leading zeros
+    bool negative;  //< true if the value is -1 - magnitude
+  };
+  /**
+   * @brief Get a zero-copy view of a bignum (tag 2 or 3) with the specified
+   * key name.  If the value is not present or is not a bignum, p is null.
+   *
+   * @param name The key name to look up.
+   * @return CborBignum
+   */
+  CborBignum getBignum(const char *name) noexcept {
+    auto element = findElement(name);
+    const uint8_t *p;
+    uint32_t length;
+    if (!readBignum(element, p, length)) {
+      return {.length = 0, .p = nullptr, .negative = false};
+    }
+    return {.length = length,
+            .p = p,
+            .negative = element.tag == kCborTagNegativeBignum};
+  }
+
+#ifdef __SIZEOF_INT128__
+  /**
+   * @brief Get a 128 bit integer with the specified key name from an integer
+   * or bignum.  If the value is not present or does not fit in T, the
+   * default value is returned.
+   *
+   * @param name The key name to look up.
+   * @return The value in the map or the defaultValue.
+   */
+  template <typename T, typename std::enable_if<
+                            (kCborIsInt128<T>::value)>::type * = nullptr>
+  T get(const char *name, const T defaultValue) noexcept {
+    bool negative;
+    unsigned __int128 magnitude;
+    if (!readInt128(findElement(name), negative, magnitude)) {
+      return defaultValue;
+    }
+    const unsigned __int128 max = T(-1) > 0
+                                      ? ~(unsigned __int128)0
+                                      : ~(unsigned __int128)0 >> 1;
+    if (magnitude > max || (negative && T(-1) > 0)) {
+      return defaultValue;
+    }
+    return negative ? T(-1) - T(magnitude) : T(magnitude);
+  }
+#endif
+
+  /**
+   * @brief Get a string value with the specified key name.  If the value is
+   * not present, the default value is returned.
+   *
+   * This method returns a pointer to the beginning of the string and assumes
+   * that this encoder has been used to encode a string with a null termination
+   * for convenience.
+   *
+   * @param name The key name to look up.
+   * @return The value in the map or the defaultValue.
+   * @return Pointer to string
+   */
+  template <typename T, typename std::enable_if<
+                            (std::is_same<const char *, T>::value ||
+                             std::is_same<char *, T>::value)>::type * = nullptr>
+  const char *get(const char *name, T defaultValue) noexcept {
+    auto element = findElement(name);
+    if (element.majorval == kCborUTF8String && isValidString(element)) {
+      const char *s = (const char *)(element.p + element.headerBytes);
+      return s;
+    }
+
+    return defaultValue;
+  }
+
+  /**
+   * @brief Get a value with the specified key name, reporting why it could
+   * not be read.  Use where a silent default hides a problem, e.g. when
+   * diagnosing producers of broken data.
+   *
+   * Supports integers (which must fit in T), enums, bool, floats, strings
+   * and MicroCborCodec types.  Missing keys and type mismatches are only
+   * returned, not recorded in getResult().
+   *
+   * @param name The key name to look up.
+   * @param value Set to the value if kCborOk is returned, otherwise
+   * unchanged
+   * @return Error kCborOk, kCborErrorNotFound, kCborErrorWrongType,
+   * kCborErrorUtf8 or an error recorded during the lookup
+   */
+  template <typename T>
+  Error tryGet(const char *name, T &value) {
+    const Error before = mResult;
+    auto element = findElement(name);
+    if (element.majorval == kCborError) {
+      return mResult != before ? mResult : Error(kCborErrorNotFound);
+    }
+    if (!matchesType<T>(element, false)) {
+      return kCborErrorWrongType;
+    }
+    if (element.majorval == kCborUTF8String && !isValidString(element)) {
+      return kCborErrorUtf8;
+    }
+    value = readerAt(element.start).get(nullptr, value);
+    return kCborOk;
+  }
+
+  /**
+   * @brief Get the length of an item.
+   *
+   * Depending on the item, the length can have different meanings so the use of
+   * this function is 'user beware'.
+   *
+   * For arrays this returns the number of bytes.
+   * For strings it returns the length of the string not including a null
+   * termination. For maps it returns the number of items in the map
+   *
+   * If the field is not found, zero is returned.
+   *
+   * @param name The name of the field to find
+   * @return uint32_t
+   */
+  uint32_t getLength(const char *name) noexcept {
+    auto element = findElement(name);
+    if (element.majorval != kCborError) {
+      auto len = getFieldValue(element);
+      uint32_t pos, bytes;
+      if (element.majorval == kCborUTF8String &&
+          element.p[element.headerBytes + len - 1] == 0) {
+        // do not count the attached null bytes
+        len -= 1;
+      } else if (element.majorval == kCborMap && len > 0 &&
+                 findKeyFilter(uint32_t(element.p - mBuf) +
+                                   element.headerBytes,
+                               pos, bytes)) {
+        // nor the key filter entry
+        len -= 1;
+      }
+      return len;
+    } else {
+      return 0;
+    }
+  }
+
+  template <typename T>
+  struct CborArray {
+    size_t length;
+    const T *p;
+
+    /**
+     * @brief The alignment of the data in bytes, i.e. the largest power of 2
+     * dividing its address.  Use to select aligned SIMD loads.
+     *
+     * @return size_t The alignment or 0 if p is null.
+     */
+    size_t alignment() const noexcept {
+      const uintptr_t address = uintptr_t(p);
+      return address & (~address + 1);
+    }
+  };
+  /**
+   * @brief Get a pointer to vector data.
+   *
+   * If the named parameter is not present, the defaultValue is returned
+   *
+   * The pointer refers to the data in place and is not checked for
+   * alignment.  Use getPointerChecked() if the producer may not have aligned
+   * the data.
+   *
+   * @tparam T The type of vector data expected.
+   * @param name The name of the field to find
+   * @param defaultValue The value to return if the name is not present or an
+   * error occurs
+   * @return struct CborArray with length an pointer to data
+   */
+  template <typename T>
+  struct CborArray<T> getPointer(const char *name,
+                                 const T *defaultValue) noexcept {
+    auto element = findElement(name);
+    if (element.tag != kCborTagInfo<T>::tag) {
+      return {.length = 0, .p = defaultValue};
+    }
+    auto length = getFieldValue(element) / sizeof(T);
+    const T *p = (T *)(element.p + element.headerBytes);
+
+    return {.length = length, .p = p};
+  }
+
+  /**
+   * @brief Get a pointer to vector data that is safe to dereference.
+   *
+   * If the data is suitably aligned for T a pointer to the data in place is
+   * returned.  Otherwise the data is copied to storage and a pointer to the
+   * copy is returned, and alignmentMisses() is incremented.
+   *
+   * If the named parameter is not present or storage is too small for the
+   * copy, the defaultValue is returned.
+   *
+   * @tparam T The type of vector data expected.
+   * @param name The name of the field to find
+   * @param defaultValue The value to return if the name is not present or an
+   * error occurs
+   * @param storage Where to copy misaligned data
+   * @param storageLength The number of elements available in storage
+   * @return struct CborArray with length an pointer to data
+   */
+  template <typename T>
+  struct CborArray<T> getPointerChecked(const char *name,
+                                        const T *defaultValue, T *storage,
+                                        const size_t storageLength) noexcept {
+    auto array = getPointer<T>(name, nullptr);
+    if (array.p == nullptr ||
+        !withinBuffer(array.p, array.length * sizeof(T))) {
+      return {.length = 0, .p = defaultValue};
+    }
+    if (uintptr_t(array.p) % alignof(T) == 0) {
+      return array;
+    }
+    mAlignmentMisses++;
+    if (array.length > storageLength) {
+      return {.length = 0, .p = defaultValue};
+    }
+    memcpy(storage, array.p, array.length * sizeof(T));
+    return {.length = array.length, .p = storage};
+  }
+
+#ifdef CONFIG_MICROCBOR_STD_VECTOR
+  /**
+   * @brief Get a pointer to vector data that is safe to dereference, copying
+   * misaligned data into storage which is resized as needed.
+   *
+   * @tparam T The type of vector data expected.
+   * @param name The name of the field to find
+   * @param defaultValue The value to return if the name is not present or an
+   * error occurs
+   * @param storage Where to copy misaligned data
+   * @return struct CborArray with length an pointer to data
+   * @throws std::bad_alloc if storage cannot be resized
+   */
+  template <typename T>
+  struct CborArray<T> getPointerChecked(const char *name,
+                                        const T *defaultValue,
+                                        std::vector<T> &storage) {
+    auto array = getPointer<T>(name, nullptr);
+    if (array.p == nullptr ||
+        !withinBuffer(array.p, array.length * sizeof(T))) {
+      return {.length = 0, .p = defaultValue};
+    }
+    if (uintptr_t(array.p) % alignof(T) == 0) {
+      return array;
+    }
+    mAlignmentMisses++;
+    if (storage.size() < array.length) {
+      storage.resize(array.length);
+    }
+    if (array.length != 0) {
+      memcpy(storage.data(), array.p, array.length * sizeof(T));
+    }
+    return {.length = array.length, .p = storage.data()};
+  }
+#endif
+
+  /**
+   * @brief Get the number of arrays that getPointerChecked() had to copy
+   * because they were not aligned.  A non-zero count identifies producers
+   * that should align their arrays.
+   *
+   * @return uint32_t
+   */
+  inline uint32_t alignmentMisses() const noexcept { return mAlignmentMisses; }
+
+  /**
+   * @brief Update a CRC32C (Castagnoli) checksum with more data.  Uses the
+   * SSE4.2 or ARMv8 CRC32 instructions when the target has them.
+   *
+   * @param crc The checksum so far, 0 to start
+   * @param data The data to add
+   * @param len The number of bytes in data
+   * @return uint32_t The updated checksum
+   */
+  static uint32_t crc32c(uint32_t crc, const void *data, size_t len) noexcept {
+    const uint8_t *p = (const uint8_t *)data;
+    crc = ~crc;
+#if defined(__SSE4_2__) && defined(__x86_64__)
+    for (; len >= 8; len -= 8, p += 8) {
+      uint64_t v;
+      memcpy(&v, p, sizeof(v));
+      crc = uint32_t(_mm_crc32_u64(crc, v));
+    }
+    for (; len > 0; len--) {
+      crc = _mm_crc32_u8(crc, *p++);
+    }
+#elif defined(__ARM_FEATURE_CRC32)
+    for (; len >= 8; len -= 8, p += 8) {
+      uint64_t v;
+      memcpy(&v, p, sizeof(v));
+      crc = __crc32cd(crc, v);
+    }
+    for (; len > 0; len--) {
+      crc = __crc32cb(crc, *p++);
+    }
+#else
+    const uint32_t *t = crc32cTable();
+    for (; len >= 8; len -= 8, p += 8) {
+      const uint32_t lo = crc ^ (uint32_t(p[0]) | uint32_t(p[1]) << 8 |
+                                 uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24);
+      crc = t[7 * 256 + (lo & 0xff)] ^ t[6 * 256 + ((lo >> 8) & 0xff)] ^
+            t[5 * 256 + ((lo >> 16) & 0xff)] ^ t[4 * 256 + (lo >> 24)] ^
+            t[3 * 256 + p[4]] ^ t[2 * 256 + p[5]] ^ t[1 * 256 + p[6]] ^
+            t[p[7]];
+    }
+    for (; len > 0; len--) {
+      crc = t[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+#endif
+    return ~crc;
+  }
+
+  /**
+   * @brief Check that data is well formed UTF-8.  Overlong encodings,
+   * surrogates and code points above U+10FFFF are rejected.
+   *
+   * ASCII runs are skipped 16 bytes at a time with SSE2 or NEON, or 8 bytes
+   * at a time otherwise, so mostly ASCII text costs well under a cycle per
+   * byte.  Multi-byte sequences are checked one at a time.
+   *
+   * @param data The data to check
+   * @param len The number of bytes in data
+   * @return true if the data is valid UTF-8
+   */
+  static bool isValidUtf8(const void *data, const size_t len) noexcept {
+    const uint8_t *p = (const uint8_t *)data;
+    const uint8_t *end = p + len;
+    while (p < end) {
+#if defined(__SSE2__)
+      while (end - p >= 16 &&
+             _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)p)) == 0) {
+        p += 16;
+      }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+      while (end - p >= 16 && vmaxvq_u8(vld1q_u8(p)) < 0x80) {
+        p += 16;
+      }
+#endif
+      while (end - p >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        if (v & 0x8080808080808080ull) {
+          break;
+        }
+        p += 8;
+      }
+      if (p == end) {
+        break;
+      }
+      const uint8_t c = *p;
+      if (c < 0x80) {
+        p++;
+        continue;
+      }
+      uint32_t n, cp, min;
+      if ((c & 0xe0) == 0xc0) {
+        n = 1, cp = c & 0x1f, min = 0x80;
+      } else if ((c & 0xf0) == 0xe0) {
+        n = 2, cp = c & 0x0f, min = 0x800;
+      } else if ((c & 0xf8) == 0xf0) {
+        n = 3, cp = c & 0x07, min = 0x10000;
+      } else {
+        return false;
+      }
+      if (size_t(end - p) <= n) {
+        return false;
+      }
+      for (uint32_t i = 1; i <= n; i++) {
+        if ((p[i] & 0xc0) != 0x80) {
+          return false;
+        }
+        cp = cp << 6 | (p[i] & 0x3f);
+      }
+      if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) {
+        return false;
+      }
+      p += n + 1;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Enable checking text strings when they are read by get().  An
+   * invalid string returns the default value.
+   *
+   * @param validate true to check strings
+   */
+  inline void setValidateUtf8(const bool validate) noexcept {
+    mValidateUtf8 = validate;
+  }
+
+  /**
+   * @brief Set the limits applied when decoding untrusted input.  Readers
+   * returned by getMap() and getArray() inherit the limits.
+   *
+   * @param limits The limits
+   */
+  inline void setLimits(const MicroCborLimits &limits) noexcept {
+    mLimits = limits;
+  }
+
+#ifdef CONFIG_MICROCBOR_MADVISE
+  /**
+   * @brief Tell the kernel how a memory mapped buffer will be read so pages
+   * are read ahead of use.
+   *
+   * @param sequential true for front to back reads such as replaying a
+   * recording, false for lookups
+   * @return Error kCborErrorUnsupported if madvise() failed
+   */
+  Error adviseMapped(const bool sequential) const noexcept {
+    return advise(mBuf, mMaxBufLen, sequential);
+  }
+
+  /**
+   * @brief Tell the kernel how a memory mapped range will be read.
+   *
+   * @param buf The start of the range
+   * @param len The length of the range in bytes
+   * @param sequential true for front to back reads
+   * @return Error kCborErrorUnsupported if madvise() failed
+   */
+  static Error advise(const void *buf, const size_t len,
+                      const bool sequential) noexcept {
+    const uintptr_t page = uintptr_t(sysconf(_SC_PAGESIZE));
+    const uintptr_t start = uintptr_t(buf) & ~(page - 1);
+    const size_t length = uintptr_t(buf) + len - start;
+    if ((sequential && madvise((void *)start, length, MADV_SEQUENTIAL) != 0) ||
+        madvise((void *)start, length, MADV_WILLNEED) != 0) {
+      return kCborErrorUnsupported;
+    }
+    return kCborOk;
+  }
+#endif
+
+  /**
+   * @brief Check every text string, including map keys, in the item at the
+   * current position in a single pass.  Use to validate a message once
+   * before handing it to sinks that require UTF-8.
+   *
+   * @return true if the item is well formed and all strings are valid UTF-8
+   */
+  bool validateStrings() noexcept {
+    const auto offset = mDataOffset;
+    const bool valid = scanField(
+        getNextField(),
+        [](const TypeInfo &info, const uint8_t *data, uint32_t length) {
+          return info.majorval != kCborUTF8String || isValidUtf8(data, length)
+                     ? Error(kCborOk)
+                     : Error(kCborErrorUtf8);
+        });
+    mDataOffset = offset;
+    return valid;
+  }
+
+  /**
+   * @brief Add a placeholder for a CRC32C checksum of the message to the top
+   * level map.  The checksum is filled in when the top level map is ended
+   * and covers every byte of the map with the 4 checksum bytes as zero.
+   *
+   * @param name The key name to associate with the checksum
+   * @return Error kCborErrorState if not in the top level map
+   */
+  Error addChecksum(const char *name) noexcept {
+    if (mDepth != 0 || mMapState[0].isArray) {
+      return fail(kCborErrorState);
+    }
+    encodeMapKey(name);
+    encodeUInt32(kCborPosInt << 5 | 26, 0);
+    if (mResult == 0) {
+      mChecksumPos = mDataOffset - 4;
+    }
+    return mResult;
+  }
+
+  /**
+   * @brief Add a sync marker before the next top level item.  The marker is
+   * the self-described CBOR tag (0xd9d9f7), which decoders ignore, so
+   * MicroCborSequence can find item starts after corruption.
+   *
+   * @return Error
+   */
+  Error addSyncMarker() noexcept {
+    if (mDepth >= 0) {
+      return fail(kCborErrorState);
+    }
+    encodePadding(3);
+    return mResult;
+  }
+
+  /**
+   * @brief Verify the CRC32C checksum stored by addChecksum() in the map at
+   * the current position.
+   *
+   * @param name The key name of the checksum
+   * @return true if the checksum is present and matches
+   */
+  bool verifyChecksum(const char *name) noexcept {
+    auto slot = findElement(name);
+    if (slot.majorval != kCborPosInt || slot.headerBytes != 5) {
+      return false;
+    }
+    auto reader = readerAt(mBuf + mDataOffset);
+    auto top = reader.getNextField();
+    reader.skipField(top);
+    const uint32_t start = uint32_t(top.p - mBuf);
+    const uint32_t end = mDataOffset + reader.mDataOffset;
+    const uint32_t pos = uint32_t(slot.p + 1 - mBuf);
+    if (reader.mResult != 0 || end > mMaxBufLen || pos + 4 > end) {
+      return false;
+    }
+    static const uint8_t zeros[4] = {0};
+    uint32_t crc = crc32c(0, mBuf + start, pos - start);
+    crc = crc32c(crc, zeros, sizeof(zeros));
+    crc = crc32c(crc, mBuf + pos + 4, end - pos - 4);
+    return crc == getFieldValue(slot);
+  }
+
+  template <typename T>
+  struct CborTensor {
+    size_t length;  //< The total number of elements
+    const T *p;
+    uint32_t dims[CONFIG_MICROCBOR_MAX_TENSOR_DIMS];
+    uint8_t numDims;
+    bool columnMajor;  //< true if the first dimension varies fastest
+
+    /**
+     * @brief Compute the element offset of a multi-dimensional index.
+     *
+     * @param index One index per dimension
+     * @return size_t The offset into p
+     */
+    size_t offset(const uint32_t *index) const noexcept {
+      size_t pos = 0;
+      for (uint8_t n = 0; n < numDims; n++) {
+        const uint8_t d = columnMajor ? numDims - 1 - n : n;
+        pos = pos * dims[d] + index[d];
+      }
+      return pos;
+    }
+  };
+  /**
+   * @brief Get a zero-copy view of a multi-dimensional array (RFC 8746 tag
+   * 40 or 1040) whose elements are a typed array of T.
+   *
+   * If the named parameter is not present or is not a tensor of T, the
+   * defaultValue is returned with zero dimensions.
+   *
+   * @tparam T The type of element data expected.
+   * @param name The name of the field to find
+   * @param defaultValue The value to return if the name is not present or an
+   * error occurs
+   * @return struct CborTensor with dimensions and pointer to data
+   */
+  template <typename T>
+  struct CborTensor<T> getTensor(const char *name,
+                                 const T *defaultValue) noexcept {
+    CborTensor<T> tensor;
+    tensor.length = 0;
+    tensor.p = defaultValue;
+    tensor.numDims = 0;
+    tensor.columnMajor = false;
+
+    auto element = findElement(name);
+    if ((element.tag != kCborTagMultiDimArray &&
+         element.tag != kCborTagMultiDimArrayColumnMajor) ||
+        element.majorval != kCborArray || getFieldValue(element) != 2) {
+      return tensor;
+    }
+
+    auto reader = readerAt(element.p);
+    reader.mDataOffset += element.headerBytes;
+    auto dims = reader.getNextField();
+    auto numDims = getFieldValue(dims);
+    if (dims.majorval != kCborArray ||
+        numDims > CONFIG_MICROCBOR_MAX_TENSOR_DIMS) {
+      return tensor;
+    }
+    reader.mDataOffset += dims.headerBytes;
+    uint64_t numElements = 1;
+    uint32_t shape[CONFIG_MICROCBOR_MAX_TENSOR_DIMS];
+    for (uint32_t d = 0; d < numDims; d++) {
+      auto dim = reader.getNextField();
+      if (dim.majorval != kCborPosInt || dim.headerBytes == 9) {
+        return tensor;
+      }
+      shape[d] = getFieldValue(dim);
+      numElements *= shape[d];
+      if (numElements > UINT32_MAX) {
+        return tensor;
+      }
+      reader.skipField(dim);
+    }
+
+    // the product is below 2^35 so it cannot wrap to match a short string
+    auto data = reader.getNextField();
+    if (data.tag != kCborTagInfo<T>::tag || data.majorval != kCborByteString ||
+        data.headerBytes == 9 ||
+        uint64_t(getFieldValue(data)) != numElements * sizeof(T) ||
+        getFieldValue(data) > reader.mMaxBufLen - reader.mDataOffset -
+                                  data.headerBytes) {
+      return tensor;
+    }
+    tensor.length = size_t(numElements);
+    tensor.p = (T *)(data.p + data.headerBytes);
+    memcpy(tensor.dims, shape, numDims * sizeof(shape[0]));
+    tensor.numDims = uint8_t(numDims);
+    tensor.columnMajor = element.tag == kCborTagMultiDimArrayColumnMajor;
+    return tensor;
+  }
+};
+
+/**
+ * @brief Read the items of a CBOR sequence (RFC 8742), such as a recording
+ * of messages, recovering from corruption.
+ *
+ * Each item is validated before it is returned.  After a malformed item the
+ * reader rescans forward for the next plausible item start and reports the
+ * bytes it skipped, so one bad byte does not lose the rest of the sequence.
+ * A candidate start must begin with the sync prefix if one is set, for
+ * example a sync marker or a map header and first key, otherwise with a
+ * map.  A checksum added with addChecksum() can be required as
+ * confirmation.
+ *
+ * @code
+ *   MicroCborSequence seq(data, len);
+ *   seq.setChecksum("crc");
+ *   MicroCbor item;
+ *   while (seq.next(item)) {
+ *     if (seq.skippedLength()) LOG_WARN("lost %u bytes", seq.skippedLength());
+ *     process(item);
+ *   }
+ * @endcode
+ */
+class MicroCborSequence {
+ public:
+  /**
+   * @brief Construct a reader over a sequence
+   *
+   * @param buf The sequence
+   * @param len The length of the sequence in bytes
+   */
+  MicroCborSequence(const void *buf, const uint32_t len) noexcept
+      : mBuf((const uint8_t *)buf), mLen(len) {}
+
+  /**
+   * @brief Require every item to start with the given bytes.  The bytes are
+   * not copied.
+   *
+   * @param prefix The bytes, e.g. {0xd9, 0xd9, 0xf7} for sync markers
+   * @param len The number of bytes
+   */
+  void setSyncPrefix(const uint8_t *prefix, const uint32_t len) noexcept {
+    mPrefix = prefix;
+    mPrefixLen = len;
+  }
+
+  /**
+   * @brief Require every item to hold a valid checksum added with
+   * addChecksum().
+   *
+   * @param name The key name of the checksum, null for none
+   */
+  void setChecksum(const char *name) noexcept { mChecksumName = name; }
+
+  /**
+   * @brief Set the limits used to validate items.
+   *
+   * @param limits The limits
+   */
+  void setLimits(const MicroCborLimits &limits) noexcept { mLimits = limits; }
+
+#ifdef CONFIG_MICROCBOR_MADVISE
+  /**
+   * @brief Tell the kernel a memory mapped sequence will be read front to
+   * back.
+   *
+   * @return Error kCborErrorUnsupported if madvise() failed
+   */
+  MicroCbor::Error adviseMapped() const noexcept {
+    return MicroCbor::advise(mBuf, mLen, true);
+  }
+#endif
+
+  /**
+   * @brief Get the next valid item.
+   *
+   * @param item Set to a read-only instance positioned on the item
+   * @return true if an item was found, false at the end of the sequence
+   */
+  bool next(MicroCbor &item) noexcept {
+    mSkippedOffset = mOffset;
+    while (mOffset < mLen) {
+      uint32_t end;
+      if (isItem(mOffset, end)) {
+        mSkippedLength = mOffset - mSkippedOffset;
+        mTotalSkipped += mSkippedLength;
+        item.initBuffer((const void *)(mBuf + mOffset), end - mOffset);
+        item.mLimits = mLimits;
+        mOffset = end;
+        if (CONFIG_MICROCBOR_PREFETCH_MIN != 0 && mOffset < mLen) {
+          // fetched while the caller processes this item
+          MICROCBOR_PREFETCH(mBuf + mOffset);
+        }
+        return true;
+      }
+      mOffset = findCandidate(mOffset + 1);
+    }
+    mSkippedLength = mLen - mSkippedOffset;
+    mTotalSkipped += mSkippedLength;
+    mOffset = mLen;
+    return false;
+  }
+
+  /**
+   * @brief The offset of the bytes skipped before the last item returned
+   * by next(), or before the end of the sequence.
+   */
+  uint32_t skippedOffset() const noexcept { return mSkippedOffset; }
+
+  /**
+   * @brief The number of bytes skipped before the last item returned by
+   * next(), 0 if none.
+   */
+  uint32_t skippedLength() const noexcept { return mSkippedLength; }
+
+  /**
+   * @brief The total number of bytes skipped so far.
+   */
+  uint32_t totalSkipped() const noexcept { return mTotalSkipped; }
+
+  /**
+   * @brief The offset of the next item to be read.
+   */
+  uint32_t offset() const noexcept { return mOffset; }
+
+ private:
+  const uint8_t *mBuf;
+  uint32_t mLen;
+  uint32_t mOffset = 0;
+  uint32_t mSkippedOffset = 0;
+  uint32_t mSkippedLength = 0;
+  uint32_t mTotalSkipped = 0;
+  const uint8_t *mPrefix = nullptr;
+  uint32_t mPrefixLen = 0;
+  const char *mChecksumName = nullptr;
+  MicroCborLimits mLimits;
+
+  /**
+   * @brief Check if a complete, well formed item starts at an offset.
+   *
+   * @param offset The candidate start
+   * @param end Set to the end of the item
+   * @return true if the item is valid
+   */
+  bool isItem(const uint32_t offset, uint32_t &end) noexcept {
+    const uint32_t available = mLen - offset;
+    if (mPrefixLen != 0 && (available < mPrefixLen ||
+                            memcmp(mBuf + offset, mPrefix, mPrefixLen) != 0)) {
+      return false;
+    }
+    MicroCbor reader((const void *)(mBuf + offset), available);
+    reader.mLimits = mLimits;
+    auto top = reader.getNextField();
+    if (mPrefixLen == 0 && top.majorval != kCborMap) {
+      return false;
+    }
+    reader.skipField(top);
+    if (reader.getResult() != kCborOk || reader.mDataOffset > available) {
+      return false;
+    }
+    end = offset + reader.mDataOffset;
+    if (mChecksumName != nullptr) {
+      if (CONFIG_MICROCBOR_PREFETCH_MIN != 0 && end < mLen) {
+        MICROCBOR_PREFETCH(mBuf + end);  // fetched while the CRC runs
+      }
+      MicroCbor item((const void *)(mBuf + offset), end - offset);
+      return item.verifyChecksum(mChecksumName);
+    }
+    return true;
+  }
+
+  /**
+   * @brief Find the next offset that could start an item.
+   *
+   * @param offset Where to start looking
+   * @return uint32_t The candidate offset or the sequence length if none
+   */
+  uint32_t findCandidate(uint32_t offset) const noexcept {
+    if (offset >= mLen) {
+      return mLen;
+    }
+    if (mPrefixLen != 0) {
+      auto p =
+          (const uint8_t *)memchr(mBuf + offset, mPrefix[0], mLen - offset);
+      return p == nullptr ? mLen : uint32_t(p - mBuf);
+    }
+    for (; offset < mLen; offset++) {
+      const uint8_t b = mBuf[offset];
+      if (b >> 5 == kCborMap || b >> 5 == kCborTag) {
+        return offset;
+      }
+    }
+    return mLen;
+  }
+};
+
+/// An unused MicroCborIndex slot
+constexpr uint32_t kCborIndexEmpty = UINT32_MAX;
+
+/**
+ * @brief A perfect hash index over the keys of a top-level map, so values in
+ * a large read-only blob are found in constant time with no parsing at
+ * startup.
+ *
+ * Each key is hashed once to pick a bucket and again with the bucket's seed
+ * to pick a slot holding the offset of the key in the blob.  The key found
+ * there is compared with the one looked up, so missing keys are detected.
+ * Indexes are usually generated at build time along with the blob by
+ * tools/MicroCborEmbed.cpp, see microcbor_embed() in
+ * cmake/MicroCborEmbed.cmake, and can be placed in read-only memory.
+ *
+ * @code
+ *   extern const MicroCborIndex kCalibrationIndex;  // generated
+ *   auto gains = kCalibrationIndex.find("gains").getPointer<float>(nullptr,
+ *                                                                  nullptr);
+ *   int32_t rate = kCalibrationIndex.find("rate").get(nullptr, 0);
+ * @endcode
+ */
+struct MicroCborIndex {
+  const uint8_t *blob;
+  uint32_t blobLen;
+  const uint32_t *seeds;  // one per bucket
+  uint32_t numBuckets;
+  const uint32_t *slots;  // key offsets in the blob, kCborIndexEmpty if unused
+  uint32_t numSlots;
+
+  /**
+   * @brief Find a value by key.
+   *
+   * @param name The key name
+   * @return MicroCbor A read-only instance positioned on the value, use null
+   * names to read it.  Empty if the key is not present.
+   */
+  MicroCbor find(const char *name) const noexcept {
+    if (numBuckets == 0 || numSlots == 0) {
+      return MicroCbor();
+    }
+    const size_t len = strlen(name);
+    const uint32_t h = MicroCbor::hashKey(name, len);
+    const uint32_t seed = seeds[MicroCbor::mixHash(h, 0) % numBuckets];
+    const uint32_t offset = slots[MicroCbor::mixHash(h, seed) % numSlots];
+    if (offset >= blobLen) {
+      return MicroCbor();
+    }
+    MicroCbor reader(blob + offset, blobLen - offset);
+    const auto key = reader.getNextField();
+    const uint32_t keyLen = reader.getFieldValue(key);
+    if (key.majorval != kCborUTF8String ||
+        keyLen > reader.mMaxBufLen - key.headerBytes || len > keyLen ||
+        strncmp(name, (const char *)key.p + key.headerBytes, keyLen) != 0) {
+      return MicroCbor();
+    }
+    reader.skipField(key);
+    return MicroCbor(blob + offset + reader.mDataOffset,
+                     blobLen - offset - reader.mDataOffset);
+  }
+
+#ifdef CONFIG_MICROCBOR_STD_VECTOR
+  /**
+   * @brief Build the seeds and slots of an index over a blob holding a map.
+   *
+   * Keys are grouped in buckets of about 4 and the largest buckets are
+   * placed first, trying seeds until all of a bucket's keys land in free
+   * slots (hash and displace).  Slots are about 80% full.
+   *
+   * @param buf The blob
+   * @param len The length of the blob in bytes
+   * @param seeds Set to the bucket seeds
+   * @param slots Set to the slots
+   * @return Error kCborErrorMalformed if the blob is not a map with string
+   * keys, kCborErrorUnsupported for duplicate keys
+   */
+  static MicroCbor::Error build(const uint8_t *buf, const uint32_t len,
+                     std::vector<uint32_t> &seeds,
+                     std::vector<uint32_t> &slots) {
+    struct Key {
+      uint32_t hash;
+      uint32_t offset;
+    };
+    std::vector<Key> keys;
+    MicroCbor reader(buf, len);
+    const auto top = reader.getNextField();
+    if (top.majorval != kCborMap) {
+      return kCborErrorMalformed;
+    }
+    uint32_t n = reader.getFieldValue(top);
+    if (n > len) {
+      return kCborErrorMalformed;
+    }
+    keys.reserve(n);
+    reader.mDataOffset += top.headerBytes;
+    while (n-- != 0) {
+      const uint32_t offset = reader.mDataOffset;
+      const auto key = reader.getNextField();
+      const uint32_t keyLen = reader.getFieldValue(key);
+      if (key.majorval != kCborUTF8String ||
+          keyLen > len - offset - key.headerBytes) {
+        return kCborErrorMalformed;
+      }
+      // keys may be followed by null padding
+      const char *name = (const char *)key.p + key.headerBytes;
+      const auto end = (const char *)memchr(name, 0, keyLen);
+      keys.push_back(
+          {MicroCbor::hashKey(name, end ? end - name : keyLen), offset});
+      reader.skipField(key);
+      reader.skipField(reader.getNextField());
+      if (reader.getResult() != kCborOk) {
+        return kCborErrorMalformed;
+      }
+    }
+
+    const uint32_t numKeys = uint32_t(keys.size());
+    const uint32_t numBuckets = numKeys / 4 + 1;
+    const uint32_t numSlots = numKeys + numKeys / 4 + 1;
+    std::vector<std::vector<uint32_t>> buckets(numBuckets);
+    for (uint32_t i = 0; i < numKeys; i++) {
+      buckets[MicroCbor::mixHash(keys[i].hash, 0) % numBuckets].push_back(i);
+    }
+    std::vector<uint32_t> order(numBuckets);
+    for (uint32_t i = 0; i < numBuckets; i++) {
+      order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return buckets[a].size() > buckets[b].size();
+    });
+
+    seeds.assign(numBuckets, 0);
+    slots.assign(numSlots, kCborIndexEmpty);
+    std::vector<uint32_t> placed;
+    for (const uint32_t b : order) {
+      const auto &bucket = buckets[b];
+      if (bucket.empty()) {
+        break;
+      }
+      // equal keys, or hashes, would never be placed
+      for (size_t i = 0; i < bucket.size(); i++) {
+        for (size_t j = i + 1; j < bucket.size(); j++) {
+          if (keys[bucket[i]].hash == keys[bucket[j]].hash) {
+            return kCborErrorUnsupported;
+          }
+        }
+      }
+      for (uint32_t seed = 1;; seed++) {
+        placed.clear();
+        for (const uint32_t k : bucket) {
+          const uint32_t slot =
+              MicroCbor::mixHash(keys[k].hash, seed) % numSlots;
+          if (slots[slot] != kCborIndexEmpty ||
+              std::find(placed.begin(), placed.end(), slot) != placed.end()) {
+            break;
+          }
+          placed.push_back(slot);
+        }
+        if (placed.size() == bucket.size()) {
+          for (size_t i = 0; i < placed.size(); i++) {
+            slots[placed[i]] = keys[bucket[i]].offset;
+          }
+          seeds[b] = seed;
+          break;
+        }
+      }
+    }
+    return kCborOk;
+  }
+#endif
+};
+
+#if __cplusplus >= 201402L
+/**
+ * @brief A CBOR encoder usable in constant expressions, so constant
+ * configuration and lookup tables can be encoded at compile time and placed
+ * in read-only memory.
+ *
+ * The output matches MicroCbor for the same calls with null terminated
+ * strings, so blobs can be read in place with MicroCbor or at compile time
+ * with MicroCborConstReader.  Integers, bools, strings, maps, arrays and
+ * unaligned integer typed arrays are supported.  Floats are not because
+ * their bits cannot be read in a constant expression before C++20.  Counts
+ * given to startMap() and startArray() must be exact.
+ *
+ * @code
+ *   constexpr MicroCborConst<64> makeConfig() {
+ *     MicroCborConst<64> cbor;
+ *     cbor.startMap(2);
+ *     cbor.add("rate", int32_t(100));
+ *     cbor.add("name", "dev");
+ *     cbor.endMap();
+ *     return cbor;
+ *   }
+ *   constexpr auto kConfig = makeConfig();
+ *   static_assert(kConfig.getResult() == kCborOk, "encoding failed");
+ *   constexpr auto kBlob = kConfig.toArray<kConfig.size()>();  // C++17
+ * @endcode
+ *
+ * @tparam N The capacity in bytes
+ */
+template <size_t N>
+class MicroCborConst {
+ public:
+  constexpr MicroCborConst() noexcept : mBuf{} {}
+
+  constexpr MicroCborConst &startMap(const uint32_t numElements) noexcept {
+    return startMap(nullptr, numElements);
+  }
+  constexpr MicroCborConst &startMap(const char *name,
+                                     const uint32_t numElements) noexcept {
+    encodeKey(name);
+    return startContainer(kCborMap, numElements);
+  }
+  constexpr MicroCborConst &endMap() noexcept { return endContainer(); }
+
+  constexpr MicroCborConst &startArray(const uint32_t numElements) noexcept {
+    return startArray(nullptr, numElements);
+  }
+  constexpr MicroCborConst &startArray(const char *name,
+                                       const uint32_t numElements) noexcept {
+    encodeKey(name);
+    return startContainer(kCborArray, numElements);
+  }
+  constexpr MicroCborConst &endArray() noexcept { return endContainer(); }
+
+  /**
+   * @brief Add an integer using the width of T, as MicroCbor::add() does.
+   */
+  template <typename T,
+            typename std::enable_if<(std::is_integral<T>::value &&
+                                     !std::is_same<bool, T>::value)>::type * =
+                nullptr>
+  constexpr MicroCborConst &add(const char *name, const T value) noexcept {
+    encodeKey(name);
+    uint8_t major = kCborPosInt;
+    uint64_t magnitude = uint64_t(value);
+    if (value < 0) {
+      major = kCborNegInt;
+      magnitude = uint64_t(-1 - int64_t(value));
+    }
+    const uint8_t minor = sizeof(T) == 8   ? 27
+                          : sizeof(T) == 4 ? 26
+                          : sizeof(T) == 2 ? 25
+                                           : 24;
+    storeByte(uint8_t(major << 5 | minor));
+    storeBigEndian(magnitude, sizeof(T));
+    return *this;
+  }
+
+  constexpr MicroCborConst &add(const char *name, const bool value) noexcept {
+    encodeKey(name);
+    storeByte(value ? kCborTrue : kCborFalse);
+    return *this;
+  }
+
+  /**
+   * @brief Add a null terminated string.
+   */
+  constexpr MicroCborConst &add(const char *name, const char *value) noexcept {
+    encodeKey(name);
+    encodeString(value, true);
+    return *this;
+  }
+
+  /**
+   * @brief Add an integer typed array without alignment padding.
+   */
+  template <typename T, size_t M,
+            typename std::enable_if<(std::is_integral<T>::value &&
+                                     !std::is_same<bool, T>::value)>::type * =
+                nullptr>
+  constexpr MicroCborConst &add(const char *name,
+                                const T (&value)[M]) noexcept {
+    encodeKey(name);
+    encodeHeader(kCborTag, kCborTagInfo<T>::tag);
+    encodeHeader(kCborByteString, uint32_t(M * sizeof(T)));
+    for (size_t i = 0; i < M; i++) {
+      // typed arrays are little endian
+      const uint64_t v = uint64_t(value[i]);
+      for (size_t b = 0; b < sizeof(T); b++) {
+        storeByte(uint8_t(v >> (8 * b)));
+      }
+    }
+    return *this;
+  }
+
+  constexpr MicroCborError getResult() const noexcept { return mResult; }
+  constexpr size_t size() const noexcept { return mOffset; }
+  constexpr const uint8_t *data() const noexcept { return mBuf; }
+
+#if __cplusplus >= 201703L
+  /**
+   * @brief Copy the encoded bytes into an array of exactly size() bytes.
+   *
+   * @tparam M The size of the array, normally size()
+   */
+  template <size_t M>
+  constexpr std::array<uint8_t, M> toArray() const noexcept {
+    std::array<uint8_t, M> a{};
+    for (size_t i = 0; i < M && i < mOffset; i++) {
+      a[i] = mBuf[i];
+    }
+    return a;
+  }
+#endif
+
+ private:
+  uint8_t mBuf[N];
+  size_t mOffset = 0;
+  MicroCborError mResult = kCborOk;
+  int mDepth = -1;
+  uint32_t mRemaining[CONFIG_MICROCBOR_MAX_NESTING] = {};
+
+  constexpr void storeByte(const uint8_t v) noexcept {
+    if (mOffset >= N) {
+      mResult = kCborErrorBufferFull;
+      return;
+    }
+    mBuf[mOffset++] = v;
+  }
+
+  constexpr void storeBigEndian(const uint64_t value,
+                                const size_t bytes) noexcept {
+    for (size_t b = bytes; b > 0; b--) {
+      storeByte(uint8_t(value >> (8 * (b - 1))));
+    }
+  }
+
+  constexpr void encodeHeader(const uint8_t majorval,
+                              const uint32_t value) noexcept {
+    if (value < 24) {
+      storeByte(uint8_t(majorval << 5 | value));
+    } else if (value < 256) {
+      storeByte(uint8_t(majorval << 5 | 24));
+      storeBigEndian(value, 1);
+    } else if (value < 0x10000) {
+      storeByte(uint8_t(majorval << 5 | 25));
+      storeBigEndian(value, 2);
+    } else {
+      storeByte(uint8_t(majorval << 5 | 26));
+      storeBigEndian(value, 4);
+    }
+  }
+
+  constexpr void encodeString(const char *value,
+                              const bool nullTerminate) noexcept {
+    uint32_t len = 0;
+    while (value[len] != 0) {
+      len++;
+    }
+    encodeHeader(kCborUTF8String, len + (nullTerminate ? 1 : 0));
+    for (uint32_t i = 0; i < len; i++) {
+      storeByte(uint8_t(value[i]));
+    }
+    if (nullTerminate) {
+      storeByte(0);
+    }
+  }
+
+  /**
+   * @brief Encode a key, or count an unnamed item, against the open map or
+   * array.
+   */
+  constexpr void encodeKey(const char *name) noexcept {
+    if (mDepth >= 0) {
+      if (mRemaining[mDepth] == 0) {
+        mResult = kCborErrorState;
+      } else {
+        mRemaining[mDepth]--;
+      }
+    }
+    if (name != nullptr && *name != 0) {
+      encodeString(name, false);
+    }
+  }
+
+  constexpr MicroCborConst &startContainer(const uint8_t majorval,
+                                           const uint32_t n) noexcept {
+    if (mDepth + 1 >= CONFIG_MICROCBOR_MAX_NESTING) {
+      mResult = kCborErrorNesting;
+      return *this;
+    }
+    encodeHeader(majorval, n);
+    mRemaining[++mDepth] = n;
+    return *this;
+  }
+
+  constexpr MicroCborConst &endContainer() noexcept {
+    if (mDepth < 0 || mRemaining[mDepth] != 0) {
+      mResult = kCborErrorState;
+      return *this;
+    }
+    mDepth--;
+    return *this;
+  }
+};
+
+/**
+ * @brief A CBOR reader usable in constant expressions, e.g. to check or
+ * fold values from a MicroCborConst blob at compile time.  Integers, bools,
+ * strings and nested maps are supported.
+ */
+class MicroCborConstReader {
+ public:
+  constexpr MicroCborConstReader(const uint8_t *buf, const size_t len) noexcept
+      : mBuf(buf), mLen(len) {}
+
+  /**
+   * @brief Get an integer or bool value from the map.  If the value is not
+   * present the default value is returned.
+   */
+  template <typename T>
+  constexpr T get(const char *name, const T defaultValue) const noexcept {
+    const size_t pos = find(name);
+    if (pos >= mLen) {
+      return defaultValue;
+    }
+    const uint8_t major = mBuf[pos] >> 5;
+    if (std::is_same<bool, T>::value) {
+      return mBuf[pos] == kCborTrue    ? T(true)
+             : mBuf[pos] == kCborFalse ? T(false)
+                                       : defaultValue;
+    }
+    if (major != kCborPosInt && major != kCborNegInt) {
+      return defaultValue;
+    }
+    const uint64_t v = value(pos);
+    return major == kCborPosInt ? T(v) : T(-1 - int64_t(v));
+  }
+
+  /**
+   * @brief Get the length of a string value, not counting a null
+   * terminator, or 0 if not present.
+   */
+  constexpr size_t getStringLength(const char *name) const noexcept {
+    const size_t pos = find(name);
+    if (pos >= mLen || mBuf[pos] >> 5 != kCborUTF8String) {
+      return 0;
+    }
+    const size_t start = pos + headerBytes(pos);
+    size_t len = size_t(value(pos));
+    if (len > 0 && mBuf[start + len - 1] == 0) {
+      len--;
+    }
+    return len;
+  }
+
+  /**
+   * @brief Check if a string value equals s.
+   */
+  constexpr bool stringEquals(const char *name, const char *s) const noexcept {
+    const size_t pos = find(name);
+    if (pos >= mLen || mBuf[pos] >> 5 != kCborUTF8String) {
+      return false;
+    }
+    const size_t start = pos + headerBytes(pos);
+    const size_t len = getStringLength(name);
+    for (size_t i = 0; i < len; i++) {
+      if (s[i] == 0 || char(mBuf[start + i]) != s[i]) {
+        return false;
+      }
+    }
+    return s[len] == 0;
+  }
+
+  /**
+   * @brief Get a reader for a nested map, or an empty reader if not present.
+   */
+  constexpr MicroCborConstReader getMap(const char *name) const noexcept {
+    const size_t pos = find(name);
+    if (pos >= mLen || mBuf[pos] >> 5 != kCborMap) {
+      return MicroCborConstReader(mBuf, 0);
+    }
+    return MicroCborConstReader(mBuf + pos, mLen - pos);
+  }
+
+ private:
+  const uint8_t *mBuf;
+  size_t mLen;
+
+  constexpr size_t headerBytes(const size_t pos) const noexcept {
+    const uint8_t minor = mBuf[pos] & 0x1f;
+    return minor < 24 ? 1 : minor == 24 ? 2 : minor == 25 ? 3 : minor == 26 ? 5
+                                                                          : 9;
+  }
+
+  constexpr uint64_t value(const size_t pos) const noexcept {
+    const size_t n = headerBytes(pos);
+    if (n == 1) {
+      return mBuf[pos] & 0x1f;
+    }
+    uint64_t v = 0;
+    for (size_t i = 1; i < n && pos + i < mLen; i++) {
+      v = v << 8 | mBuf[pos + i];
+    }
+    return v;
+  }
+
+  /**
+   * @brief Get the offset following the item at pos, or mLen if malformed.
+   */
+  constexpr size_t skip(size_t pos) const noexcept {
+    if (pos >= mLen || (mBuf[pos] & 0x1f) > 27) {
+      return mLen;
+    }
+    const uint8_t major = mBuf[pos] >> 5;
+    const uint64_t v = value(pos);
+    pos += headerBytes(pos);
+    if (major == kCborByteString || major == kCborUTF8String) {
+      return v > mLen - pos ? mLen : pos + size_t(v);
+    }
+    if (major == kCborTag) {
+      return skip(pos);
+    }
+    if (major == kCborMap || major == kCborArray) {
+      const uint64_t items = major == kCborMap ? 2 * v : v;
+      for (uint64_t i = 0; i < items && pos < mLen; i++) {
+        pos = skip(pos);
+      }
+    }
+    return pos < mLen ? pos : mLen;
+  }
+
+  /**
+   * @brief Get the offset of the value for a key in the map, or mLen.
+   */
+  constexpr size_t find(const char *name) const noexcept {
+    if (mLen == 0 || mBuf[0] >> 5 != kCborMap) {
+      return mLen;
+    }
+    const uint64_t n = value(0);
+    size_t pos = headerBytes(0);
+    for (uint64_t i = 0; i < n && pos < mLen; i++) {
+      const size_t valuePos = skip(pos);
+      if (mBuf[pos] >> 5 == kCborUTF8String) {
+        const size_t start = pos + headerBytes(pos);
+        size_t k = 0;
+        while (start + k < valuePos && name[k] != 0 &&
+               char(mBuf[start + k]) == name[k]) {
+          k++;
+        }
+        // keys may be followed by null padding
+        if (name[k] == 0 && (start + k == valuePos || mBuf[start + k] == 0)) {
+          return valuePos;
+        }
+      }
+      pos = skip(valuePos);
+    }
+    return mLen;
+  }
+};
+#endif
+
 static_assert(sizeof(double) == 8, "Unexpected `double` size");
 
 }  // namespace entazza
@@ -0,0 +1,49 @@
+/*********************************************************************************
+ * SPDX-License-Identifier: MIT
+ *
+ * @brief Check the output of the MicroCborEmbed tool.  MicroCborEmbedTest.json
+ * holds maps with more than 23 entries, whose headers need the wider count,
+ * with typed arrays that must still be aligned in place.
+ ********************************************************************************/
+#include "kEmbedTest.h"
+
+#include <stdio.h>
+
+using namespace entazza;
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+}  // namespace
+
+int main() {
+  check(kEmbedTestIndex.find("k23").get(nullptr, 0) == 69, "k23");
+
+  auto gains = kEmbedTestIndex.find("gains").getPointer<double>(nullptr,
+                                                                nullptr);
+  check(gains.length == 4 && gains.alignment() >= alignof(double),
+        "gains aligned");
+  check(gains.p != nullptr && gains.p[3] == 3.5, "gains values");
+
+  MicroCbor inner = kEmbedTestIndex.find("inner");
+  check(inner.getLength(nullptr) == 26, "inner count");
+  check(inner.get("s23", "") != nullptr, "inner s23");
+  auto weights = inner.getPointer<double>("weights", nullptr);
+  check(weights.length == 3 && weights.alignment() >= alignof(double),
+        "weights aligned");
+  check(weights.p != nullptr && weights.p[2] == 3e3, "weights values");
+  auto taps = inner.getPointer<int32_t>("taps", nullptr);
+  check(taps.length == 3 && taps.alignment() >= alignof(int32_t),
+        "taps aligned");
+  check(taps.p != nullptr && taps.p[1] == -8, "taps values");
+
+  return failures == 0 ? 0 : 1;
+}
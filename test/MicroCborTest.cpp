@@ -1,12 +1,94 @@
 // SPDX-License-Identifier: MIT
 #include <microcbor/MicroCbor.hpp>
 
+#include <list>
+#include <sstream>
+
 #include "gtest/gtest.h"
 #ifdef CONFIG_MICROCBOR_STD_VECTOR
 #include <vector>
 #endif
+#ifdef CONFIG_MICROCBOR_STD_CHRONO
+#include <chrono>
+#endif
+#ifdef CONFIG_MICROCBOR_STD_CONTAINERS
+#include <array>
+#include <map>
+#include <string>
+#include <unordered_map>
+#endif
+#ifdef CONFIG_MICROCBOR_THREADS
+#include <atomic>
+#include <stdexcept>
+#endif
 using namespace entazza;
 
+struct Vec3 {
+  float x, y, z;
+};
+struct Sample {
+  int32_t id;
+  Vec3 pos;
+};
+struct Gains {
+  double g[2];
+};
+
+namespace entazza {
+template <>
+struct MicroCborCodec<Vec3> {
+  static constexpr uint16_t tag = 40001;
+  static void encode(MicroCbor &cbor, const Vec3 &v) {
+    cbor.add(nullptr, &v.x, 3, false);
+  }
+  static bool decode(MicroCbor &item, Vec3 &v) {
+    float xyz[3];
+    auto a = item.getPointerChecked<float>(nullptr, nullptr, xyz, 3);
+    if (a.length != 3) {
+      return false;
+    }
+    v = {a.p[0], a.p[1], a.p[2]};
+    return true;
+  }
+};
+
+// An untagged codec encoding a map
+template <>
+struct MicroCborCodec<Sample> {
+  static constexpr uint16_t tag = kCborTagInvalid;
+  static void encode(MicroCbor &cbor, const Sample &s) {
+    cbor.startMap(nullptr, 2);
+    cbor.add("id", s.id);
+    cbor.add("pos", s.pos);
+    cbor.endMap();
+  }
+  static bool decode(MicroCbor &item, Sample &s) {
+    s.id = item.get("id", -1);
+    s.pos = item.get("pos", Vec3{0, 0, 0});
+    return s.id != -1;
+  }
+};
+
+// A codec with an aligned array
+template <>
+struct MicroCborCodec<Gains> {
+  static constexpr uint16_t tag = kCborTagInvalid;
+  static void encode(MicroCbor &cbor, const Gains &g) {
+    cbor.startMap(nullptr, 1);
+    cbor.add("g", g.g, 2);
+    cbor.endMap();
+  }
+  static bool decode(MicroCbor &item, Gains &g) {
+    auto a = item.getPointer<double>("g", nullptr);
+    if (a.length != 2) {
+      return false;
+    }
+    g = {{a.p[0], a.p[1]}};
+    return true;
+  }
+};
+}  // namespace entazza
+
 TEST(microcbor, empty) {
   uint8_t buf[200];
   MicroCbor cbor(buf, sizeof(buf));
@@ -262,6 +344,1348 @@ TEST(microcbor, vector) {
 }
 #endif
 
+TEST(microcbor, tensor) {
+  alignas(8) uint8_t buf[200];
+  MicroCbor cbor(buf, sizeof(buf));
+
+  // 2x3 row-major matrix
+  const int32_t m[] = {1, 2, 3, 4, 5, 6};
+  const uint32_t dims[] = {2, 3};
+  // transposed view of m: 3x2 by walking m with strides {1, 3}
+  const uint32_t strides[] = {1, 3};
+  const uint32_t tdims[] = {3, 2};
+  cbor.startMap();
+  cbor.add("v", 1);
+  cbor.addTensor("m", m, dims, 2);
+  cbor.addTensor("mt", m, tdims, 2, strides, false);
+  cbor.addTensor("mc", m, tdims, 2, true);
+  cbor.endMap();
+  cbor.restart();
+
+  auto t = cbor.getTensor<int32_t>("m", nullptr);
+  ASSERT_NE(nullptr, t.p);
+  ASSERT_EQ(0, uintptr_t(t.p) % sizeof(int32_t));
+  ASSERT_EQ(6, t.length);
+  ASSERT_EQ(2, t.numDims);
+  ASSERT_EQ(2, t.dims[0]);
+  ASSERT_EQ(3, t.dims[1]);
+  ASSERT_FALSE(t.columnMajor);
+  const uint32_t idx[] = {1, 2};
+  ASSERT_EQ(6, t.p[t.offset(idx)]);
+
+  auto tt = cbor.getTensor<int32_t>("mt", nullptr);
+  ASSERT_EQ(3, tt.dims[0]);
+  const int32_t expected[] = {1, 4, 2, 5, 3, 6};
+  for (int i = 0; i < 6; i++) {
+    ASSERT_EQ(expected[i], tt.p[i]);
+  }
+
+  // column-major: the same memory viewed with the first index fastest
+  auto tc = cbor.getTensor<int32_t>("mc", nullptr);
+  ASSERT_TRUE(tc.columnMajor);
+  const uint32_t cidx[] = {1, 1};
+  ASSERT_EQ(5, tc.p[tc.offset(cidx)]);
+
+  // wrong element type or not a tensor returns the default
+  ASSERT_EQ(nullptr, cbor.getTensor<float>("m", nullptr).p);
+  ASSERT_EQ(0, cbor.getTensor<int32_t>("v", nullptr).numDims);
+  ASSERT_EQ(1, cbor.get("v", 0));
+
+  // element counts that overflow are rejected
+  const uint32_t huge[] = {65536, 65536};
+  MicroCbor overflow(buf, sizeof(buf));
+  ASSERT_EQ(kCborErrorUnsupported, overflow.addTensor(nullptr, m, huge, 2));
+  // 27905 * 429509837 * 384773 * 4 wraps to 4 bytes in 64 bits
+  const uint8_t wrapped[] = {0xa1, 0x61, 't',  0xd8, 40,   0x82, 0x83,
+                             0x19, 0x6d, 0x01, 0x1a, 0x19, 0x99, 0xcc,
+                             0xcd, 0x1a, 0x00, 0x05, 0xdf, 0x05, 0xd8,
+                             78,   0x44, 1,    0,    0,    0};
+  MicroCbor reader(wrapped, sizeof(wrapped));
+  ASSERT_EQ(0, reader.getTensor<int32_t>("t", nullptr).length);
+}
+
+TEST(microcbor, arrays) {
+  uint8_t buf[400];
+  MicroCbor cbor(buf, sizeof(buf));
+  cbor.startMap();
+  // homogeneous records of the same size
+  cbor.startArray("recs", 3, true);
+  for (int32_t i = 0; i < 3; i++) {
+    cbor.startMap();
+    cbor.add("id", i);
+    cbor.add("x", float(i) / 2);
+    cbor.endMap();
+  }
+  cbor.endArray();
+  // homogeneous but variable sized items
+  cbor.startArray("names", 0, true);
+  cbor.add(nullptr, "a");
+  cbor.add(nullptr, "bcd");
+  cbor.endArray();
+  // more items than fit in the header written by startMap()
+  cbor.startMap("big");
+  char key[4] = "k00";
+  for (int i = 0; i < 30; i++) {
+    key[1] = '0' + i / 10;
+    key[2] = '0' + i % 10;
+    cbor.add<uint8_t>(key, i);
+  }
+  cbor.endMap();
+  cbor.add("after", 7);
+  cbor.endMap();
+  ASSERT_EQ(0, cbor.getResult());
+  cbor.restart();
+
+  auto recs = cbor.getArray("recs");
+  ASSERT_EQ(3, recs.length);
+  ASSERT_TRUE(recs.homogeneous());
+  ASSERT_EQ(2, recs.at(2).get("id", -1));
+  ASSERT_EQ(0.5f, recs.at(1).get("x", 0.0f));
+  ASSERT_EQ(-1, recs.at(3).get("id", -1));
+
+  auto names = cbor.getArray("names");
+  ASSERT_EQ(2, names.length);
+  ASSERT_FALSE(names.homogeneous());
+  ASSERT_EQ(0, strcmp("bcd", names.at(1).get(nullptr, "")));
+
+  auto big = cbor.getMap("big");
+  ASSERT_EQ(29, big.get<uint8_t>("k29", 0));
+  ASSERT_EQ(7, cbor.get("after", 0));
+
+  // tag 41 from other encoders only means the items have the same type
+  const uint8_t other[] = {0xa1, 0x61, 'a',  0xd8, 0x29, 0x83,
+                           0x01, 0x19, 0x01, 0x2c, 0x02};
+  MicroCbor reader(other, sizeof(other));
+  auto ints = reader.getArray("a");
+  ASSERT_FALSE(ints.homogeneous());
+  ASSERT_EQ(300, ints.at(1).get(nullptr, 0));
+  ASSERT_EQ(2, ints.at(2).get(nullptr, 0));
+
+  // a corrupt count is limited to the items the buffer can hold
+  const uint8_t huge[] = {0xa1, 0x61, 'a',  0xd9, 0x00, 0x29, 0x9a,
+                          0xff, 0xff, 0xff, 0xff, 0x1a, 0x00, 0x00,
+                          0x00, 0x01, 0x1a, 0x00, 0x00, 0x00, 0x02};
+  MicroCbor hreader(huge, sizeof(huge));
+  auto hlist = hreader.getArray("a");
+  ASSERT_TRUE(hlist.homogeneous());
+  ASSERT_EQ(2u, hlist.length);
+  ASSERT_EQ(2, hlist.at(1).get(nullptr, 0));
+  ASSERT_EQ(-1, hlist.at(858993460).get(nullptr, -1));
+  ASSERT_EQ(-1, hlist.at(1717986918).get(nullptr, -1));
+
+  // growing the header would move aligned arrays, so a count is required
+  alignas(8) uint8_t abuf[400];
+  const double d[] = {1.5, 2.5};
+  MicroCbor aligned(abuf, sizeof(abuf));
+  aligned.startMap();
+  aligned.add("d", d, 2);
+  for (int i = 0; i < 30; i++) {
+    key[1] = '0' + i / 10;
+    key[2] = '0' + i % 10;
+    aligned.add<uint8_t>(key, i);
+  }
+  ASSERT_EQ(kCborErrorUnsupported, aligned.endMap());
+  aligned.restart();
+  aligned.startMap(31);
+  aligned.add("d", d, 2);
+  ASSERT_EQ(0, aligned.endMap());
+}
+
+TEST(microcbor, alignment) {
+  alignas(4096) static uint8_t buf[3 * 4096];
+  MicroCbor cbor(buf, sizeof(buf));
+  const float data[] = {1, 2, 3, 4, 5, 6, 7, 8};
+  cbor.startMap();
+  cbor.add("a", uint8_t(1));
+  cbor.addAligned("f64", data, 8, 64);
+  cbor.addAligned("page", data, 8, 4096);
+  // unnamed arrays are padded with no-op tags
+  cbor.startArray("list");
+  for (uint32_t i = 1; i <= 8; i++) {
+    cbor.addAligned(nullptr, data, i, 32);
+  }
+  cbor.endArray();
+  cbor.add("b", uint8_t(2));
+  cbor.endMap();
+  ASSERT_EQ(0, cbor.getResult());
+  cbor.restart();
+
+  auto f64 = cbor.getPointer<float>("f64", nullptr);
+  ASSERT_EQ(8, f64.length);
+  ASSERT_EQ(0, f64.alignment() % 64);
+  ASSERT_EQ(8.0f, f64.p[7]);
+  ASSERT_EQ(0, cbor.getPointer<float>("page", nullptr).alignment() % 4096);
+
+  auto list = cbor.getArray("list");
+  ASSERT_EQ(8, list.length);
+  for (uint32_t i = 0; i < 8; i++) {
+    auto array = list.at(i).getPointer<float>(nullptr, nullptr);
+    ASSERT_EQ(i + 1, array.length);
+    ASSERT_EQ(0, array.alignment() % 32);
+  }
+  ASSERT_EQ(2, cbor.get<uint8_t>("b", 0));
+  ASSERT_EQ(0, cbor.getPointer<float>("none", nullptr).alignment());
+
+  // add() leaves unnamed arrays unpadded as before
+  uint8_t plain[32];
+  MicroCbor items(plain, sizeof(plain));
+  items.startArray();
+  items.add(nullptr, data, 2);
+  items.endArray();
+  const uint8_t expected[] = {0x81, 0xd8, kCborTagFloat32, 0x48};
+  ASSERT_EQ(0, memcmp(expected, plain, sizeof(expected)));
+}
+
+TEST(microcbor, misaligned) {
+  alignas(8) uint8_t buf[200];
+  MicroCbor cbor(buf, sizeof(buf));
+  const double data[] = {1.5, 2.5, 3.5};
+  cbor.startMap();
+  // data starts 9 bytes into the buffer
+  cbor.add("odd", data, 3, false);
+  cbor.add("aligned", data, 3);
+  cbor.endMap();
+  cbor.restart();
+
+  double storage[3];
+  auto aligned = cbor.getPointerChecked<double>("aligned", nullptr, storage, 3);
+  ASSERT_NE((const double *)storage, aligned.p);
+  ASSERT_EQ(0, cbor.alignmentMisses());
+
+  auto odd = cbor.getPointerChecked<double>("odd", nullptr, storage, 3);
+  ASSERT_EQ((const double *)storage, odd.p);
+  ASSERT_EQ(3, odd.length);
+  ASSERT_EQ(3.5, odd.p[2]);
+  ASSERT_EQ(1, cbor.alignmentMisses());
+
+  // storage too small
+  ASSERT_EQ(nullptr, cbor.getPointerChecked<double>("odd", nullptr, storage, 2).p);
+#ifdef CONFIG_MICROCBOR_STD_VECTOR
+  std::vector<double> arena;
+  auto copy = cbor.getPointerChecked<double>("odd", nullptr, arena);
+  ASSERT_EQ(arena.data(), copy.p);
+  ASSERT_EQ(2.5, copy.p[1]);
+#endif
+
+  // a length past the end of the buffer is not copied
+  const uint8_t truncated[] = {0xa1, 0x61, 'v', 0xd8, kCborTagFloat64,
+                               0x5a, 0x00, 0x10, 0x00, 0x00, 0, 0, 0};
+  MicroCbor reader(truncated, sizeof(truncated));
+  ASSERT_EQ(nullptr,
+            reader.getPointerChecked<double>("v", nullptr, storage, 3).p);
+#ifdef CONFIG_MICROCBOR_STD_VECTOR
+  std::vector<double> unused;
+  ASSERT_EQ(nullptr, reader.getPointerChecked<double>("v", nullptr, unused).p);
+  ASSERT_EQ(0u, unused.size());
+#endif
+}
+
+#ifdef CONFIG_MICROCBOR_STD_CHRONO
+TEST(microcbor, time) {
+  using namespace std::chrono;
+  uint8_t buf[200];
+  MicroCbor cbor(buf, sizeof(buf));
+  const system_clock::time_point whole(seconds(1700000000));
+  const system_clock::time_point fine =
+      whole + milliseconds(250) + microseconds(3);
+  const system_clock::time_point before(seconds(-10) + milliseconds(500));
+  cbor.startMap();
+  cbor.add("whole", whole);
+  cbor.add("fine", fine);
+  cbor.add("before", before);
+  cbor.add("fixed", fine, true);
+  cbor.add("dur", milliseconds(1500));
+  cbor.add("i", 1);
+  cbor.endMap();
+  ASSERT_EQ(0, cbor.getResult());
+  cbor.restart();
+
+  const system_clock::time_point none;
+  ASSERT_EQ(whole, cbor.get("whole", none));
+  ASSERT_EQ(fine, cbor.get("fine", none));
+  ASSERT_EQ(before, cbor.get("before", none));
+  ASSERT_EQ(fine, cbor.get("fixed", none));
+  ASSERT_EQ(milliseconds(1500), cbor.get("dur", milliseconds(0)));
+  ASSERT_EQ(1500000, cbor.get("dur", microseconds(0)).count());
+
+  // wrong kind or not present
+  ASSERT_EQ(none, cbor.get("dur", none));
+  ASSERT_EQ(seconds(5), cbor.get("whole", seconds(5)));
+  ASSERT_EQ(none, cbor.get("i", none));
+
+  // fixed width encoding does not depend on the value
+  MicroCbor a(buf, sizeof(buf));
+  a.add(nullptr, whole, true);
+  MicroCbor b(buf, sizeof(buf));
+  b.add(nullptr, fine, true);
+  ASSERT_EQ(a.bytesSerialized(), b.bytesSerialized());
+
+  // other clocks do not count from the Unix epoch so are durations
+  const steady_clock::time_point up(milliseconds(1234));
+  MicroCbor steady(buf, sizeof(buf));
+  steady.startMap();
+  steady.add("up", up);
+  steady.endMap();
+  steady.restart();
+  ASSERT_EQ(up, steady.get("up", steady_clock::time_point()));
+  ASSERT_EQ(milliseconds(1234), steady.get("up", milliseconds(0)));
+  ASSERT_EQ(none, steady.get("up", none));
+
+  // NaN, out of range seconds and fractions return the default
+  const uint8_t nan[] = {0xa1, 0x61, 't',  0xc1, 0xfb, 0x7f,
+                         0xf8, 0,    0,    0,    0,    0, 0, 0};
+  const uint8_t huge[] = {0xa1, 0x61, 't',  0xc1, 0x1b, 0x0d,
+                          0xe0, 0xb6, 0xb3, 0xa7, 0x64, 0, 0};
+  const uint8_t fraction[] = {0xa1, 0x61, 't',  0xd9, 0x03, 0xe9,
+                              0xa2, 0x01, 0x00, 0x22, 0x1b, 0x7f,
+                              0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+  ASSERT_EQ(none, MicroCbor(nan, sizeof(nan)).get("t", none));
+  ASSERT_EQ(none, MicroCbor(huge, sizeof(huge)).get("t", none));
+  ASSERT_EQ(none, MicroCbor(fraction, sizeof(fraction)).get("t", none));
+
+  // repeated fractions could overflow their sum so are malformed
+  const uint8_t repeated[] = {0xa1, 0x61, 't',  0xd9, 0x03, 0xe9, 0xa3,
+                              0x01, 0x00, 0x28, 0x1a, 0x3b, 0x9a, 0xc9,
+                              0xff, 0x28, 0x1a, 0x3b, 0x9a, 0xc9, 0xff};
+  MicroCbor twice(repeated, sizeof(repeated));
+  ASSERT_EQ(none, twice.get("t", none));
+  ASSERT_EQ(kCborErrorMalformed, twice.getResult());
+}
+#endif
+
+TEST(microcbor, bignum) {
+  uint8_t buf[200];
+  MicroCbor cbor(buf, sizeof(buf));
+  const uint8_t big[] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+                         0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10,
+                         0x11, 0x12, 0x13, 0x14};
+  cbor.startMap();
+  cbor.addBignum("big", big, sizeof(big), true);
+#ifdef __SIZEOF_INT128__
+  const unsigned __int128 u = (unsigned __int128)0x0102030405060708ULL << 64 |
+                              0x090a0b0c0d0e0f10ULL;
+  const __int128 neg = -(__int128)u;
+  cbor.add("u128", u);
+  cbor.add("i128", neg);
+  cbor.add("small", (__int128)-5);
+#endif
+  cbor.endMap();
+  ASSERT_EQ(0, cbor.getResult());
+  cbor.restart();
+
+  auto b = cbor.getBignum("big");
+  ASSERT_EQ(sizeof(big), b.length);
+  ASSERT_TRUE(b.negative);
+  ASSERT_EQ(0, memcmp(big, b.p, sizeof(big)));
+  ASSERT_EQ(nullptr, cbor.getBignum("none").p);
+#ifdef __SIZEOF_INT128__
+  ASSERT_TRUE(u == cbor.get("u128", (unsigned __int128)0));
+  ASSERT_TRUE(neg == cbor.get("i128", (__int128)0));
+  ASSERT_TRUE(-5 == cbor.get("small", (__int128)0));
+  ASSERT_EQ(-5, cbor.get<int64_t>("small", 0));
+  // does not fit
+  ASSERT_TRUE(7 == cbor.get("big", (__int128)7));
+  ASSERT_TRUE(7 == cbor.get("i128", (unsigned __int128)7));
+  ASSERT_EQ(16, cbor.getBignum("u128").length);
+#endif
+
+  // a length near 2^32 must not wrap past the bounds check
+  const uint8_t wrap[] = {0xa1, 0x61, 'b',  0xc2, 0x5a, 0xff,
+                          0xff, 0xff, 0xfe, 0x01, 0x02};
+  ASSERT_EQ(nullptr, MicroCbor(wrap, sizeof(wrap)).getBignum("b").p);
+}
+
+TEST(microcbor, codec) {
+  uint8_t buf[200];
+  MicroCbor cbor(buf, sizeof(buf));
+  cbor.startMap();
+  cbor.add("v", Vec3{1, 2, 3});
+  cbor.startArray("samples");
+  cbor.add(nullptr, Sample{7, {4, 5, 6}});
+  cbor.add(nullptr, Sample{8, {7, 8, 9}});
+  cbor.endArray();
+  cbor.add("f", 1.5f);
+  cbor.endMap();
+  ASSERT_EQ(0, cbor.getResult());
+  cbor.restart();
+
+  auto v = cbor.get("v", Vec3{0, 0, 0});
+  ASSERT_EQ(3.0f, v.z);
+  auto samples = cbor.getArray("samples");
+  ASSERT_EQ(2, samples.length);
+  auto s = samples.at(1).get(nullptr, Sample{0, {0, 0, 0}});
+  ASSERT_EQ(8, s.id);
+  ASSERT_EQ(9.0f, s.pos.z);
+  ASSERT_EQ(1.5f, cbor.get("f", 0.0f));
+
+  // wrong tag
+  ASSERT_EQ(-1.0f, cbor.get("f", Vec3{-1, -1, -1}).x);
+
+  // arrays aligned within a codec item stop the header growing under them
+  alignas(8) uint8_t abuf[400];
+  MicroCbor grown(abuf, sizeof(abuf));
+  grown.startMap();
+  grown.add("gains", Gains{{1.5, 2.5}});
+  for (int32_t i = 0; i < 30; i++) {
+    char name[8];
+    snprintf(name, sizeof(name), "k%d", i);
+    grown.add(name, i);
+  }
+  ASSERT_EQ(kCborErrorUnsupported, grown.endMap());
+}
+
+enum class Mode : uint16_t { kIdle = 1, kRun = 300 };
+
+TEST(microcbor, enums) {
+  uint8_t buf[200];
+  MicroCbor cbor(buf, sizeof(buf));
+  cbor.startMap();
+  cbor.add("idle", Mode::kIdle);
+  cbor.add("run", Mode::kRun);
+  cbor.endMap();
+  // map + 2 keys of 5 and 4 bytes + 1 and 3 byte values
+  ASSERT_EQ(1 + 5 + 1 + 4 + 3, cbor.bytesSerialized());
+  cbor.restart();
+  ASSERT_EQ(Mode::kIdle, cbor.get("idle", Mode::kRun));
+  ASSERT_EQ(Mode::kRun, cbor.get("run", Mode::kIdle));
+  ASSERT_EQ(Mode::kRun, cbor.get("none", Mode::kRun));
+}
+
+#if __cplusplus >= 201703L
+TEST(microcbor, optional_variant) {
+  uint8_t buf[200];
+  MicroCbor cbor(buf, sizeof(buf));
+  std::optional<int32_t> some = 5, none;
+  std::variant<int32_t, float, const char *, Vec3> vi = 7, vf = 2.5f,
+                                                    vs = "hi",
+                                                    vv = Vec3{1, 2, 3};
+  std::variant<int16_t, int32_t> narrow = int32_t(9);
+  cbor.startMap();
+  cbor.add("some", some);
+  cbor.add("none", none);
+  cbor.add("null", none, true);
+  cbor.add("vi", vi);
+  cbor.add("vf", vf);
+  cbor.add("vs", vs);
+  cbor.add("vv", vv);
+  cbor.add("narrow", narrow);
+  cbor.endMap();
+  cbor.restart();
+
+  ASSERT_EQ(5, cbor.get("some", std::optional<int32_t>()).value());
+  ASSERT_EQ(-1, cbor.get("none", std::optional<int32_t>(-1)).value());
+  ASSERT_FALSE(cbor.get("null", std::optional<int32_t>(-1)).has_value());
+  ASSERT_EQ(-1, cbor.get("vs", std::optional<int32_t>(-1)).value());
+
+  decltype(vi) empty = -1;
+  ASSERT_EQ(7, std::get<int32_t>(cbor.get("vi", empty)));
+  ASSERT_EQ(2.5f, std::get<float>(cbor.get("vf", empty)));
+  ASSERT_EQ(0, strcmp("hi", std::get<const char *>(cbor.get("vs", empty))));
+  ASSERT_EQ(3.0f, std::get<Vec3>(cbor.get("vv", empty)).z);
+  ASSERT_EQ(1, cbor.get("narrow", std::variant<int16_t, int32_t>()).index());
+  ASSERT_EQ(-1, std::get<int32_t>(cbor.get("missing", empty)));
+
+  // alternatives with the same encoding are told apart by the tag
+  std::variant<int32_t, uint32_t> u = uint32_t(5);
+  std::variant<Mode, int32_t> m = int32_t(3);
+  MicroCbor same(buf, sizeof(buf));
+  same.startMap();
+  same.add("u", u);
+  same.add("m", m);
+  same.startArray("list");
+  same.add(nullptr, u);
+  same.endArray();
+  same.endMap();
+  same.restart();
+  ASSERT_EQ(u, same.get("u", std::variant<int32_t, uint32_t>()));
+  ASSERT_EQ(m, same.get("m", std::variant<Mode, int32_t>()));
+  ASSERT_EQ(1, same.getArray("list").length);
+  ASSERT_EQ(u, same.getArray("list").at(0).get(
+                   nullptr, std::variant<int32_t, uint32_t>()));
+
+  // untagged values from other encoders match by type
+  const uint8_t plain[] = {0xa1, 0x61, 'v', 0xfa, 0x40, 0x20, 0, 0};
+  MicroCbor other(plain, sizeof(plain));
+  ASSERT_EQ(2.5f, std::get<float>(other.get("v", empty)));
+}
+#endif
+
+#ifdef CONFIG_MICROCBOR_STD_CONTAINERS
+TEST(microcbor, containers) {
+  uint8_t buf[1000];
+  MicroCbor cbor(buf, sizeof(buf));
+  std::map<std::string, int32_t> counts = {{"a", 1}, {"bb", 2}, {"ccc", 3}};
+  std::unordered_map<std::string, std::string> names = {{"x", "ex"},
+                                                        {"y", "why"}};
+  std::vector<std::string> words = {"alpha", "", "gamma"};
+  std::vector<Sample> samples = {{1, {1, 2, 3}}, {2, {4, 5, 6}}};
+  std::array<double, 3> coords = {{1.5, 2.5, 3.5}};
+  std::array<std::string, 2> pair = {{"left", "right"}};
+  cbor.startMap();
+  cbor.add("counts", counts);
+  cbor.add("names", names);
+  cbor.add("words", words);
+  cbor.add("samples", samples);
+  cbor.add("coords", coords);
+  cbor.add("pair", pair);
+  cbor.add("s", std::string("str"));
+  cbor.endMap();
+  cbor.restart();
+
+  ASSERT_EQ(counts, cbor.get("counts", std::map<std::string, int32_t>()));
+  ASSERT_EQ(names, cbor.get("names", decltype(names)()));
+  ASSERT_EQ(words, cbor.get("words", std::vector<std::string>()));
+  auto s = cbor.get("samples", std::vector<Sample>());
+  ASSERT_EQ(2u, s.size());
+  ASSERT_EQ(2u, s.capacity());
+  ASSERT_EQ(2, s[1].id);
+  ASSERT_EQ(6.0f, s[1].pos.z);
+  ASSERT_EQ(coords, cbor.get("coords", std::array<double, 3>()));
+  ASSERT_EQ(3u, cbor.get("coords", std::vector<double>()).size());
+  ASSERT_EQ(pair, cbor.get("pair", std::array<std::string, 2>()));
+  ASSERT_EQ("str", cbor.get("s", std::string()));
+
+  // Wrong lengths and types return the default
+  std::array<double, 2> def = {{-1, -1}};
+  ASSERT_EQ(def, cbor.get("coords", def));
+  ASSERT_EQ("def", cbor.get("counts", std::string("def")));
+  ASSERT_TRUE(cbor.get("s", std::map<std::string, int32_t>()).empty());
+
+  // lengths past the end of the buffer or not a whole number of items
+  const uint8_t truncated[] = {0xa1, 0x61, 'v', 0xd8, kCborTagFloat32,
+                               0x5a, 0x00, 0x10, 0x00, 0x00, 0, 0, 0, 0};
+  const uint8_t partial[] = {0xa1, 0x61, 'v', 0xd8, kCborTagFloat32,
+                             0x43, 1,    2,   3};
+  const std::vector<float> none = {-1};
+  const std::array<float, 1> one = {{-1}};
+  MicroCbor t(truncated, sizeof(truncated));
+  ASSERT_EQ(none, t.get("v", none));
+  ASSERT_EQ(one, t.get("v", one));
+  MicroCbor p(partial, sizeof(partial));
+  ASSERT_EQ(none, p.get("v", none));
+}
+#endif
+
+TEST(microcbor, ranges) {
+  alignas(8) uint8_t buf[1000];
+  MicroCbor cbor(buf, sizeof(buf));
+  const int32_t values[] = {1, 2, 3, 4, 5};
+  std::list<int32_t> odd;
+  for (auto v : values) {
+    if (v & 1) odd.push_back(v);
+  }
+  std::istringstream text("10 20 30");
+  int32_t n = 0;
+  cbor.startMap();
+  cbor.add("pad", uint8_t(1));
+  cbor.addRange("odd", odd.begin(), odd.end());
+  cbor.addRange("text", std::istream_iterator<int32_t>(text),
+                std::istream_iterator<int32_t>());
+  cbor.addGenerated<float>("squares", [&n](float &v) {
+    v = float(n * n);
+    return ++n <= 4;
+  });
+  cbor.addGenerated<Vec3>("none", [](Vec3 &) { return false; });
+  cbor.addRange("empty", odd.end(), odd.end());
+  cbor.endMap();
+  cbor.restart();
+
+  auto a = cbor.getPointer<int32_t>("odd", nullptr);
+  ASSERT_EQ(3u, a.length);
+  ASSERT_EQ(0u, uintptr_t(a.p) % sizeof(int32_t));
+  ASSERT_EQ(5, a.p[2]);
+  auto t = cbor.getPointer<int32_t>("text", nullptr);
+  ASSERT_EQ(3u, t.length);
+  ASSERT_EQ(0u, uintptr_t(t.p) % sizeof(int32_t));
+  ASSERT_EQ(30, t.p[2]);
+  auto sq = cbor.getPointer<float>("squares", nullptr);
+  ASSERT_EQ(4u, sq.length);
+  ASSERT_EQ(9.0f, sq.p[3]);
+  ASSERT_EQ(0u, cbor.getArray("none").length);
+  ASSERT_EQ(0u, cbor.getPointer<int32_t>("empty", nullptr).length);
+  ASSERT_EQ(1, cbor.get("pad", 0));
+}
+
+TEST(microcbor, strided) {
+  alignas(8) uint8_t buf[500];
+  MicroCbor cbor(buf, sizeof(buf));
+  Sample samples[4];
+  for (int32_t i = 0; i < 4; i++) {
+    samples[i] = {i, {i * 1.0f, i * 2.0f, i * 3.0f}};
+  }
+  const float weights[] = {0.5f, 1.5f, 2.5f, 3.5f};
+  const uint32_t pick[] = {3, 0, 2};
+  cbor.startMap();
+  cbor.add("pad", uint8_t(1));
+  cbor.addStrided("y", &samples[0].pos.y, sizeof(Sample), 4);
+  cbor.addStrided("id", &samples[0].id, sizeof(Sample), 4, false);
+  cbor.addGathered("w", weights, pick, 3);
+  cbor.endMap();
+  cbor.restart();
+
+  auto y = cbor.getPointer<float>("y", nullptr);
+  ASSERT_EQ(4u, y.length);
+  ASSERT_EQ(0u, uintptr_t(y.p) % sizeof(float));
+  ASSERT_EQ(6.0f, y.p[3]);
+  int32_t ids[4];
+  auto id = cbor.getPointerChecked<int32_t>("id", nullptr, ids, 4);
+  ASSERT_EQ(4u, id.length);
+  ASSERT_EQ(2, id.p[2]);
+  auto w = cbor.getPointer<float>("w", nullptr);
+  ASSERT_EQ(3u, w.length);
+  ASSERT_EQ(3.5f, w.p[0]);
+  ASSERT_EQ(2.5f, w.p[2]);
+
+  // unnamed arrays match add() from a contiguous copy
+  const float ys[] = {0.0f, 2.0f, 4.0f, 6.0f};
+  uint8_t gathered[64], contiguous[64];
+  MicroCbor g(gathered, sizeof(gathered));
+  g.startArray(2);
+  g.add(nullptr, uint8_t(1));
+  g.addStrided(nullptr, &samples[0].pos.y, sizeof(Sample), 4);
+  g.endArray();
+  MicroCbor c(contiguous, sizeof(contiguous));
+  c.startArray(2);
+  c.add(nullptr, uint8_t(1));
+  c.add(nullptr, ys, 4);
+  c.endArray();
+  ASSERT_EQ(c.bytesSerialized(), g.bytesSerialized());
+  ASSERT_EQ(0, memcmp(contiguous, gathered, c.bytesSerialized()));
+}
+
+TEST(microcbor, checksum) {
+  ASSERT_EQ(0xE3069283u, MicroCbor::crc32c(0, "123456789", 9));
+  ASSERT_EQ(0xE3069283u,
+            MicroCbor::crc32c(MicroCbor::crc32c(0, "1234", 4), "56789", 5));
+  // RFC 3720 vectors, long enough for 8 byte steps
+  uint8_t block[32];
+  memset(block, 0, sizeof(block));
+  ASSERT_EQ(0x8A9136AAu, MicroCbor::crc32c(0, block, sizeof(block)));
+  memset(block, 0xff, sizeof(block));
+  ASSERT_EQ(0x62A8AB43u, MicroCbor::crc32c(0, block, sizeof(block)));
+
+  uint8_t buf[500];
+  MicroCbor cbor(buf, sizeof(buf));
+  cbor.startMap();
+  cbor.add("id", int32_t(7));
+  cbor.addChecksum("crc");
+  // enough items to widen the map header after the checksum slot
+  for (int i = 0; i < 30; i++) {
+    char key[8];
+    snprintf(key, sizeof(key), "k%d", i);
+    cbor.add(key, i);
+  }
+  ASSERT_EQ(kCborErrorState, MicroCbor(buf, sizeof(buf)).addChecksum("crc"));
+  ASSERT_EQ(0, cbor.endMap());
+  const uint32_t len = cbor.bytesSerialized();
+
+  MicroCbor reader((const uint8_t *)buf, len);
+  ASSERT_TRUE(reader.verifyChecksum("crc"));
+  ASSERT_EQ(29, reader.get("k29", -1));
+  ASSERT_FALSE(reader.verifyChecksum("id"));
+  buf[len - 1] ^= 1;
+  ASSERT_FALSE(reader.verifyChecksum("crc"));
+}
+
+TEST(microcbor, utf8) {
+  ASSERT_TRUE(MicroCbor::isValidUtf8("plain ascii text, long enough", 29));
+  ASSERT_TRUE(MicroCbor::isValidUtf8("caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80", 14));
+  ASSERT_FALSE(MicroCbor::isValidUtf8("\xc0\xaf", 2));          // overlong
+  ASSERT_FALSE(MicroCbor::isValidUtf8("\xed\xa0\x80", 3));      // surrogate
+  ASSERT_FALSE(MicroCbor::isValidUtf8("\xf4\x90\x80\x80", 4));  // > U+10FFFF
+  ASSERT_FALSE(MicroCbor::isValidUtf8("0123456789abcdef\xe2\x82", 18));
+  ASSERT_FALSE(MicroCbor::isValidUtf8("0123456789abcdef01234\x80", 22));
+
+  uint8_t buf[200];
+  MicroCbor cbor(buf, sizeof(buf));
+  cbor.startMap();
+  cbor.add("good", "ok \xe2\x82\xac");
+  cbor.startMap("nested");
+  cbor.add("bad", "x\xffy");
+  cbor.endMap();
+  cbor.endMap();
+  cbor.restart();
+
+  ASSERT_FALSE(cbor.validateStrings());
+  ASSERT_EQ(0, strcmp("x\xffy", cbor.getMap("nested").get("bad", "")));
+  cbor.setValidateUtf8(true);
+  ASSERT_EQ(0, strcmp("ok \xe2\x82\xac", cbor.get("good", "")));
+  ASSERT_EQ(0, strcmp("def", cbor.getMap("nested").get("bad", "def")));
+
+  *(uint8_t *)memchr(buf, 0xff, sizeof(buf)) = 'z';
+  ASSERT_TRUE(cbor.validateStrings());
+}
+
+TEST(microcbor, limits) {
+  // A map claiming 2^32-1 items
+  const uint8_t huge[] = {0xba, 0xff, 0xff, 0xff, 0xff, 0x61, 'a', 0x01};
+  MicroCbor h(huge, sizeof(huge));
+  ASSERT_EQ(-1, h.get("b", -1));
+  ASSERT_EQ(0, h.getResult());
+  MicroCborLimits limits;
+  limits.maxContainerItems = 100;
+  h.setLimits(limits);
+  ASSERT_EQ(-1, h.get("b", -1));
+  ASSERT_EQ(kCborErrorLimit, h.getResult());
+
+  // Reserved and indefinite length minor values are rejected
+  const uint8_t reserved[] = {0xa2, 0x61, 'a', 0x1f, 0x61, 'b', 0x02};
+  MicroCbor r(reserved, sizeof(reserved));
+  ASSERT_EQ(-1, r.get("a", -1));
+  ASSERT_EQ(-1, r.get("b", -1));
+
+  // Deep nesting is skipped without recursion and stops at maxDepth
+  uint8_t deep[2000];
+  deep[0] = 0xa2;
+  deep[1] = 0x61;
+  deep[2] = 'a';
+  memset(deep + 3, 0x81, sizeof(deep) - 8);
+  memcpy(deep + sizeof(deep) - 5, "\x00\x61\x62\x05", 4);
+  MicroCbor d(deep, sizeof(deep));
+  ASSERT_EQ(-1, d.get("b", -1));
+  ASSERT_EQ(kCborErrorLimit, d.getResult());
+
+  uint8_t buf[300];
+  MicroCbor cbor(buf, sizeof(buf));
+  cbor.startMap();
+  cbor.add("s", "a long string value");
+  for (int i = 0; i < 10; i++) {
+    char key[8];
+    snprintf(key, sizeof(key), "k%d", i);
+    cbor.add(key, i);
+  }
+  cbor.endMap();
+  cbor.restart();
+  ASSERT_EQ(9, cbor.get("k9", -1));
+  limits = MicroCborLimits();
+  limits.maxStringLength = 8;
+  cbor.setLimits(limits);
+  ASSERT_EQ(-1, cbor.get("k9", -1));
+  ASSERT_EQ(kCborErrorLimit, cbor.getResult());
+
+  cbor.restart();
+  limits = MicroCborLimits();
+  limits.maxWork = 7;
+  cbor.setLimits(limits);
+  ASSERT_EQ(2, cbor.get("k2", -1));
+  ASSERT_EQ(-1, cbor.get("k2", -1));
+  ASSERT_EQ(kCborErrorLimit, cbor.getResult());
+
+  // a 64 bit length of 2^32 + 3 is not read as 3
+  const uint8_t wide[] = {0xa2, 0x61, 's', 0x7b, 0, 0,   0,   1,   0,
+                          0,    0,    3,   'a',  'b', 'c', 0x61, 'k', 1};
+  MicroCbor w(wide, sizeof(wide));
+  ASSERT_EQ(-1, w.get("k", -1));
+  ASSERT_EQ(kCborErrorUnsupported, w.getResult());
+}
+
+TEST(microcbor, errors) {
+  uint8_t buf[20];
+  MicroCbor cbor(buf, sizeof(buf));
+  cbor.startMap();
+  cbor.add("a", int32_t(1));
+  cbor.startMap("m");
+  cbor.add("long", "this does not fit");
+  cbor.add("b", int32_t(2));
+  cbor.endMap();
+  cbor.endMap();
+  ASSERT_EQ(kCborErrorBufferFull, cbor.getResult());
+  ASSERT_EQ(2, cbor.errorDepth());
+  ASSERT_EQ(17u, cbor.errorOffset());  // the value of "long"
+
+  cbor.restart();
+  cbor.startMap();
+  for (int i = 0; i < CONFIG_MICROCBOR_MAX_NESTING; i++) {
+    cbor.startArray();
+  }
+  ASSERT_EQ(kCborErrorNesting, cbor.getResult());
+  ASSERT_EQ(0, MicroCbor((void *)nullptr, 0).getResult());
+  ASSERT_EQ(kCborErrorReadOnly, MicroCbor((const void *)buf, 0).startMap());
+
+  uint8_t buf2[100];
+  MicroCbor enc(buf2, sizeof(buf2));
+  enc.startMap();
+  enc.add("i", int32_t(100000));
+  enc.add("f", 1.5f);
+  enc.add("s", "text");
+  enc.endMap();
+  enc.restart();
+  int32_t i = -1;
+  int16_t narrow = -1;
+  const char *str = nullptr;
+  ASSERT_EQ(kCborOk, enc.tryGet("i", i));
+  ASSERT_EQ(100000, i);
+  ASSERT_EQ(kCborErrorWrongType, enc.tryGet("i", narrow));
+  ASSERT_EQ(kCborErrorWrongType, enc.tryGet("f", i));
+  ASSERT_EQ(kCborErrorNotFound, enc.tryGet("x", i));
+  ASSERT_EQ(kCborOk, enc.tryGet("s", str));
+  ASSERT_EQ(0, strcmp("text", str));
+  ASSERT_EQ(-1, narrow);
+  ASSERT_EQ(kCborOk, enc.getResult());
+
+  // integers must fit in T, whatever their encoded width
+  uint8_t buf3[100];
+  MicroCbor edges(buf3, sizeof(buf3));
+  edges.startMap();
+  edges.add("p127", int32_t(127));
+  edges.add("p128", int32_t(128));
+  edges.add("n128", int32_t(-128));
+  edges.add("n129", int32_t(-129));
+  edges.add("u32", UINT32_MAX);
+  edges.add("u64", UINT64_MAX);
+  edges.endMap();
+  edges.restart();
+  int8_t i8 = 0;
+  int32_t i32 = 0;
+  int64_t i64 = 0;
+  uint64_t u64 = 0;
+  ASSERT_EQ(kCborOk, edges.tryGet("p127", i8));
+  ASSERT_EQ(127, i8);
+  ASSERT_EQ(kCborErrorWrongType, edges.tryGet("p128", i8));
+  ASSERT_EQ(kCborOk, edges.tryGet("n128", i8));
+  ASSERT_EQ(-128, i8);
+  ASSERT_EQ(kCborErrorWrongType, edges.tryGet("n129", i8));
+  ASSERT_EQ(kCborErrorWrongType, edges.tryGet("u32", i32));
+  ASSERT_EQ(kCborOk, edges.tryGet("u32", i64));
+  ASSERT_EQ(kCborErrorWrongType, edges.tryGet("u64", i64));
+  ASSERT_EQ(kCborOk, edges.tryGet("u64", u64));
+  ASSERT_EQ(UINT64_MAX, u64);
+
+  // A map whose last value is cut short
+  const uint8_t truncated[] = {0xa2, 0x61, 'a', 0x01, 0x61, 'b', 0x82, 0x01};
+  MicroCbor t(truncated, sizeof(truncated));
+  ASSERT_EQ(kCborErrorMalformed, t.tryGet("c", i));
+  ASSERT_EQ(kCborErrorMalformed, t.getResult());
+  ASSERT_EQ(6u, t.errorOffset());
+}
+
+TEST(microcbor, append) {
+  uint8_t buf[512] = {};
+  MicroCbor cbor(buf, sizeof(buf));
+  cbor.addSyncMarker();
+  cbor.startMap();
+  for (int32_t i = 0; i < 22; i++) {
+    char name[8];
+    snprintf(name, sizeof(name), "f%d", i);
+    cbor.add(name, i);
+  }
+  cbor.endMap();
+  ASSERT_EQ(0, cbor.getResult());
+  const uint32_t used = cbor.bytesSerialized();
+
+  // a later stage adds fields, widening the count header
+  MicroCbor stage;
+  ASSERT_EQ(0, stage.appendToMap(buf, used, sizeof(buf)));
+  stage.add("t1", int32_t(100));
+  stage.add("t2", int32_t(200));
+  stage.add("note", "late");
+  ASSERT_EQ(0, stage.endMap());
+  ASSERT_EQ(used + 1 + 2 * 8 + 10, stage.bytesSerialized());
+
+  MicroCbor reader((const uint8_t *)buf, stage.bytesSerialized());
+  ASSERT_EQ(21, reader.get("f21", -1));
+  ASSERT_EQ(200, reader.get("t2", -1));
+  ASSERT_EQ(0, strcmp("late", reader.get("note", "")));
+  ASSERT_EQ(25u, reader.getLength(nullptr));
+
+  // widening would move aligned arrays already in the map
+  alignas(8) uint8_t abuf[512] = {};
+  const double d[] = {1.5, 2.5, 3.5, 4.5};
+  MicroCbor withArray(abuf, sizeof(abuf));
+  withArray.startMap(23);
+  withArray.add("d", d, 4);
+  for (int32_t i = 0; i < 22; i++) {
+    char name[8];
+    snprintf(name, sizeof(name), "f%d", i);
+    withArray.add(name, i);
+  }
+  ASSERT_EQ(0, withArray.endMap());
+  MicroCbor late;
+  ASSERT_EQ(0, late.appendToMap(abuf, withArray.bytesSerialized(),
+                                sizeof(abuf)));
+  late.add("t1", int32_t(1));
+  late.add("t2", int32_t(2));
+  ASSERT_EQ(kCborErrorUnsupported, late.endMap());
+
+  // only complete maps can be reopened
+  ASSERT_EQ(kCborErrorMalformed, stage.appendToMap(buf, used - 1, sizeof(buf)));
+  ASSERT_EQ(kCborErrorMalformed, stage.appendToMap(buf, used, used - 1));
+  cbor.restart();
+  cbor.add(nullptr, int32_t(1));
+  ASSERT_EQ(kCborErrorMalformed,
+            stage.appendToMap(buf, cbor.bytesSerialized(), sizeof(buf)));
+}
+
+TEST(microcbor, encoded) {
+  uint8_t msg[64];
+  MicroCbor inner(msg, sizeof(msg));
+  inner.startMap();
+  inner.add("seq", int32_t(7));
+  inner.add("name", "sensor");
+  inner.endMap();
+  const uint32_t msgLen = inner.bytesSerialized();
+
+  uint8_t buf[256];
+  MicroCbor cbor(buf, sizeof(buf));
+  cbor.startMap();
+  cbor.add("source", "bridge");
+  ASSERT_EQ(0, cbor.addEncoded("payload", msg, msgLen));
+  cbor.startArray("history");
+  cbor.addEncoded(nullptr, msg, msgLen);
+  cbor.addEncoded(nullptr, msg, msgLen);
+  cbor.endArray();
+  cbor.endMap();
+  ASSERT_EQ(0, cbor.getResult());
+
+  MicroCbor reader((const uint8_t *)buf, cbor.bytesSerialized());
+  ASSERT_EQ(0, strcmp("bridge", reader.get("source", "")));
+  auto payload = reader.getMap("payload");
+  ASSERT_EQ(7, payload.get("seq", -1));
+  ASSERT_EQ(0, strcmp("sensor", payload.get("name", "")));
+  auto history = reader.getArray("history");
+  ASSERT_EQ(2u, history.length);
+  ASSERT_EQ(7, history.at(1).get("seq", -1));
+
+  // truncated items and trailing bytes are rejected
+  cbor.restart();
+  cbor.startMap();
+  ASSERT_EQ(kCborErrorMalformed, cbor.addEncoded("x", msg, msgLen - 1));
+  cbor.restart();
+  cbor.startMap();
+  ASSERT_EQ(kCborErrorMalformed, cbor.addEncoded("x", msg, msgLen + 1));
+  cbor.restart();
+  cbor.startMap();
+  MicroCborLimits limits;
+  limits.maxStringLength = 4;
+  cbor.setLimits(limits);
+  ASSERT_EQ(kCborErrorLimit, cbor.addEncoded("x", msg, msgLen));
+}
+
+#ifdef CONFIG_MICROCBOR_THREADS
+TEST(microcbor, parallel) {
+  const auto record = [](MicroCbor &cbor, uint32_t i) {
+    float samples[40];
+    for (uint32_t k = 0; k < 40; k++) {
+      samples[k] = float(i + k);
+    }
+    cbor.startMap();
+    cbor.add("id", int32_t(i));
+    cbor.add("name", i % 3 ? "short" : "a somewhat longer name");
+    cbor.add("samples", samples, 1 + i % 40);  // aligned
+    cbor.endMap();
+  };
+  const uint32_t n = 1000;
+  std::vector<uint8_t> serial(200000);
+  MicroCbor cbor(serial.data(), uint32_t(serial.size()));
+  cbor.startMap();
+  cbor.add("version", int32_t(1));
+  cbor.startArray("records", n);
+  for (uint32_t i = 0; i < n; i++) {
+    record(cbor, i);
+  }
+  cbor.endArray();
+  cbor.startMap("index", n);
+  for (uint32_t i = 0; i < n; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "r%u", i);
+    cbor.add(name, i);
+  }
+  cbor.endMap();
+  cbor.endMap();
+  ASSERT_EQ(0, cbor.getResult());
+
+  std::vector<uint8_t> parallel(serial.size());
+  MicroCbor pcbor(parallel.data(), uint32_t(parallel.size()));
+  pcbor.startMap();
+  pcbor.add("version", int32_t(1));
+  pcbor.addArrayParallel("records", n, record, 4);
+  pcbor.addMapParallel("index", n,
+                       [](MicroCbor &c, uint32_t i) {
+                         char name[16];
+                         snprintf(name, sizeof(name), "r%u", i);
+                         c.add(name, i);
+                       },
+                       4);
+  pcbor.endMap();
+  ASSERT_EQ(0, pcbor.getResult());
+  ASSERT_EQ(cbor.bytesSerialized(), pcbor.bytesSerialized());
+  ASSERT_EQ(0, memcmp(serial.data(), parallel.data(), cbor.bytesSerialized()));
+
+  // too small a buffer reports the same size needed
+  MicroCbor small(parallel.data(), 1000);
+  small.startMap();
+  small.add("version", int32_t(1));
+  small.addArrayParallel("records", n, record, 4);
+  ASSERT_EQ(kCborErrorBufferFull, small.getResult());
+  cbor.restart();
+  cbor.startMap();
+  cbor.add("version", int32_t(1));
+  cbor.startArray("records", n);
+  for (uint32_t i = 0; i < n; i++) {
+    record(cbor, i);
+  }
+  cbor.endArray();
+  ASSERT_EQ(cbor.bytesNeeded(), small.bytesNeeded());
+
+  // the chunks keep the limits and exceptions reach the caller
+  const uint8_t nested[] = {0x81, 0x81, 0x81, 0x01};  // [[[1]]]
+  const auto addNested = [&](MicroCbor &c, uint32_t) {
+    c.addEncoded(nullptr, nested, sizeof(nested));
+  };
+  MicroCborLimits limits;
+  limits.maxDepth = 2;
+  MicroCbor limited(parallel.data(), uint32_t(parallel.size()));
+  limited.setLimits(limits);
+  limited.addArrayParallel(nullptr, 64, addNested, 4);
+  ASSERT_EQ(kCborErrorLimit, limited.getResult());
+  MicroCbor throwing(parallel.data(), uint32_t(parallel.size()));
+  ASSERT_THROW(throwing.addArrayParallel(nullptr, n,
+                                         [](MicroCbor &c, uint32_t i) {
+                                           if (i == 500) {
+                                             throw std::runtime_error("fn");
+                                           }
+                                           c.add(nullptr, i);
+                                         },
+                                         4),
+               std::runtime_error);
+}
+
+TEST(microcbor, traverse) {
+  const uint32_t n = 5000;
+  std::vector<uint8_t> buf(200000);
+  MicroCbor cbor(buf.data(), uint32_t(buf.size()));
+  cbor.startMap();
+  cbor.startArray("records", n);
+  for (uint32_t i = 0; i < n; i++) {
+    cbor.startMap();
+    cbor.add("id", i);
+    if (i % 7 == 0) {
+      cbor.add("note", "a longer, uneven record");
+    }
+    cbor.endMap();
+  }
+  cbor.endArray();
+  cbor.startMap("byName");
+  cbor.add("a", int32_t(1));
+  cbor.add("b", int32_t(2));
+  cbor.endMap();
+  cbor.endMap();
+  ASSERT_EQ(0, cbor.getResult());
+
+  MicroCbor reader((const uint8_t *)buf.data(), cbor.bytesSerialized());
+  std::vector<uint32_t> seen(n, UINT32_MAX);
+  ASSERT_EQ(0, reader.forEachParallel(
+                   "records",
+                   [&](MicroCbor &item, uint32_t i) {
+                     seen[i] = item.get("id", UINT32_MAX);
+                   },
+                   4));
+  for (uint32_t i = 0; i < n; i++) {
+    ASSERT_EQ(i, seen[i]);
+  }
+  std::atomic<int32_t> sum(0);
+  ASSERT_EQ(0, reader.getMap("byName").forEachParallel(
+                   nullptr,
+                   [&](MicroCbor &value, uint32_t) {
+                     sum += value.get(nullptr, 0);
+                   },
+                   2));
+  ASSERT_EQ(3, sum);
+
+  auto ignore = [](MicroCbor &, uint32_t) {};
+  ASSERT_EQ(kCborErrorNotFound, reader.forEachParallel("missing", ignore));
+  ASSERT_EQ(kCborErrorWrongType,
+            reader.getMap("byName").forEachParallel("a", ignore));
+  MicroCbor truncated((const uint8_t *)buf.data(), cbor.bytesSerialized() / 2);
+  ASSERT_EQ(kCborErrorMalformed, truncated.forEachParallel("records", ignore));
+  ASSERT_THROW(reader.forEachParallel("records",
+                                      [](MicroCbor &, uint32_t i) {
+                                        if (i == 100) {
+                                          throw std::runtime_error("fn");
+                                        }
+                                      },
+                                      4),
+               std::runtime_error);
+}
+#endif
+
+TEST(microcbor, sequence) {
+  // Record five messages, each with a sync marker and checksum
+  uint8_t recording[500];
+  uint32_t len = 0;
+  uint32_t starts[5];
+  for (int32_t i = 0; i < 5; i++) {
+    uint8_t buf[64];
+    MicroCbor cbor(buf, sizeof(buf));
+    cbor.addSyncMarker();
+    cbor.startMap();
+    cbor.add("seq", i);
+    cbor.add("name", "message");
+    cbor.addChecksum("crc");
+    cbor.endMap();
+    ASSERT_EQ(0, cbor.getResult());
+    starts[i] = len;
+    memcpy(recording + len, buf, cbor.bytesSerialized());
+    len += cbor.bytesSerialized();
+    if (i == 2) {
+      // garbage between messages
+      memset(recording + len, 0xa5, 7);
+      len += 7;
+    }
+  }
+  recording[starts[1] + 12] ^= 0x20;  // flip a bit in message 1
+
+  MicroCborSequence seq(recording, len);
+  const uint8_t marker[] = {0xd9, 0xd9, 0xf7};
+  seq.setSyncPrefix(marker, sizeof(marker));
+  seq.setChecksum("crc");
+  MicroCbor item;
+  int32_t expected[] = {0, 2, 3, 4};
+  for (auto e : expected) {
+    ASSERT_TRUE(seq.next(item));
+    ASSERT_EQ(e, item.get("seq", -1));
+    ASSERT_EQ(0, strcmp("message", item.get("name", "")));
+    if (e == 2) {
+      ASSERT_EQ(starts[1], seq.skippedOffset());
+      ASSERT_EQ(starts[2] - starts[1], seq.skippedLength());
+    } else if (e == 3) {
+      ASSERT_EQ(7u, seq.skippedLength());
+    } else {
+      ASSERT_EQ(0u, seq.skippedLength());
+    }
+  }
+  ASSERT_FALSE(seq.next(item));
+  ASSERT_EQ(starts[2] - starts[1] + 7, seq.totalSkipped());
+
+  // Without a prefix or checksum only structural damage is detected
+  MicroCborSequence plain(recording + starts[3], len - starts[3]);
+  ASSERT_TRUE(plain.next(item));
+  ASSERT_EQ(3, item.get("seq", -1));
+  ASSERT_TRUE(plain.next(item));
+  ASSERT_EQ(4, item.get("seq", -1));
+  ASSERT_FALSE(plain.next(item));
+  ASSERT_EQ(0u, plain.totalSkipped());
+}
+
+TEST(microcbor, index) {
+  alignas(8) uint8_t buf[4096];
+  MicroCbor cbor(buf, sizeof(buf));
+  const float gains[] = {1.5f, 2.5f, 3.5f};
+  cbor.startMap(201);  // a count keeps the header from moving the floats
+  for (int32_t i = 0; i < 200; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "k%d", i);
+    cbor.add(name, i * 3);
+  }
+  cbor.add("gains", gains, 3, true);
+  cbor.endMap();
+  ASSERT_EQ(0, cbor.getResult());
+
+  std::vector<uint32_t> seeds;
+  std::vector<uint32_t> slots;
+  ASSERT_EQ(0, MicroCborIndex::build(buf, cbor.bytesSerialized(), seeds,
+                                     slots));
+  const MicroCborIndex index = {buf,
+                                cbor.bytesSerialized(),
+                                seeds.data(),
+                                uint32_t(seeds.size()),
+                                slots.data(),
+                                uint32_t(slots.size())};
+  for (int32_t i = 0; i < 200; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "k%d", i);
+    ASSERT_EQ(i * 3, index.find(name).get(nullptr, -1));
+  }
+  // padded keys of aligned arrays are found
+  auto p = index.find("gains").getPointer<float>(nullptr, nullptr);
+  ASSERT_EQ(3u, p.length);
+  ASSERT_EQ(2.5f, p.p[1]);
+  ASSERT_EQ(-1, index.find("k200").get(nullptr, -1));
+  ASSERT_EQ(-1, index.find("k1").get("x", -1));
+  ASSERT_EQ(-1, index.find("").get(nullptr, -1));
+
+  // duplicate keys cannot be indexed
+  cbor.restart();
+  cbor.startMap();
+  cbor.add("a", 1);
+  cbor.add("a", 2);
+  cbor.endMap();
+  ASSERT_EQ(kCborErrorUnsupported,
+            MicroCborIndex::build(buf, cbor.bytesSerialized(), seeds, slots));
+}
+
+TEST(microcbor, keyfilter) {
+  alignas(8) uint8_t buf[2048] = {};
+  const float gains[] = {1.5f, 2.5f};
+  MicroCbor cbor(buf, sizeof(buf));
+  cbor.startMap(53);  // the keys, gains, sub and the filter
+  ASSERT_EQ(0, cbor.addKeyFilter(16));
+  for (int32_t i = 0; i < 100; i += 2) {
+    char name[16];
+    snprintf(name, sizeof(name), "k%d", i);
+    cbor.add(name, i);
+  }
+  cbor.add("gains", gains, 2, true);
+  cbor.startMap("sub");
+  cbor.add("x", int32_t(1));
+  cbor.endMap();
+  cbor.endMap();
+  ASSERT_EQ(0, cbor.getResult());
+
+  MicroCbor reader((const uint8_t *)buf, cbor.bytesSerialized());
+  for (int32_t i = 0; i < 100; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "k%d", i);
+    ASSERT_EQ(i % 2 ? -1 : i, reader.get(name, -1));
+  }
+  ASSERT_EQ(2.5f, reader.getPointer<float>("gains", nullptr).p[1]);
+  ASSERT_EQ(1, reader.getMap("sub").get("x", -1));
+  ASSERT_EQ(52u, reader.getLength(nullptr));  // the filter is not counted
+
+  // the filter follows the widened header, an empty key and its tag
+  ASSERT_EQ(0x60, buf[2]);
+  memset(buf + 7, 0, 16);
+  ASSERT_EQ(-1, reader.get("k2", -1));
+  memset(buf + 7, 0xff, 16);
+  ASSERT_EQ(2, reader.get("k2", -1));
+
+  // appended keys are added to the filter
+  memset(buf + 7, 0, 16);
+  MicroCbor stage;
+  ASSERT_EQ(0, stage.appendToMap(buf, cbor.bytesSerialized(), sizeof(buf)));
+  stage.add("late", int32_t(7));
+  ASSERT_EQ(0, stage.endMap());
+  MicroCbor appended((const uint8_t *)buf, stage.bytesSerialized());
+  ASSERT_EQ(7, appended.get("late", -1));
+
+  // whole map decoders skip the filter
+  uint8_t small[64] = {};
+  MicroCbor pair(small, sizeof(small));
+  pair.startMap(3);
+  pair.addKeyFilter(4);
+  pair.add("x", int32_t(1));
+  pair.add("y", int32_t(2));
+  pair.endMap();
+  MicroCbor pairReader((const uint8_t *)small, pair.bytesSerialized());
+  ASSERT_EQ(2u, pairReader.getLength(nullptr));
+#ifdef CONFIG_MICROCBOR_STD_CONTAINERS
+  const std::map<std::string, int32_t> xy = {{"x", 1}, {"y", 2}};
+  ASSERT_EQ(xy, pairReader.get(nullptr, std::map<std::string, int32_t>()));
+#endif
+#ifdef CONFIG_MICROCBOR_THREADS
+  std::atomic<int32_t> sum(0);
+  ASSERT_EQ(0, pairReader.forEachParallel(
+                   nullptr,
+                   [&](MicroCbor &value, uint32_t) {
+                     sum += value.get(nullptr, 0);
+                   },
+                   2));
+  ASSERT_EQ(3, sum);
+#endif
+
+  // only at the start of a map
+  cbor.restart();
+  cbor.startMap();
+  cbor.add("a", int32_t(1));
+  ASSERT_EQ(kCborErrorState, cbor.addKeyFilter());
+
+  // a key outside any map has no filter to set
+  cbor.restart();
+  ASSERT_EQ(0, cbor.add("a", int32_t(1)));
+  ASSERT_EQ(2u + 5u, cbor.bytesSerialized());
+}
+
+#if __cplusplus >= 201402L
+constexpr MicroCborConst<128> makeConfig() {
+  MicroCborConst<128> cbor;
+  const int16_t table[] = {1, -2, 300};
+  cbor.startMap(5);
+  cbor.add("rate", int32_t(100));
+  cbor.add("offset", int8_t(-3));
+  cbor.add("on", true);
+  cbor.add("name", "dev");
+  cbor.startMap("sub", 1);
+  cbor.add("table", table);
+  cbor.endMap();
+  cbor.endMap();
+  return cbor;
+}
+constexpr auto kConfig = makeConfig();
+
+TEST(microcbor, constexpr_blob) {
+  static_assert(kConfig.getResult() == kCborOk, "encoding failed");
+  constexpr MicroCborConstReader kReader(kConfig.data(), kConfig.size());
+  static_assert(kReader.get("rate", 0) == 100, "rate");
+  static_assert(kReader.get("offset", 0) == -3, "offset");
+  static_assert(kReader.get("on", false), "on");
+  static_assert(kReader.get("missing", 7) == 7, "missing");
+  static_assert(kReader.getStringLength("name") == 3, "name length");
+  static_assert(kReader.stringEquals("name", "dev"), "name");
+  static_assert(!kReader.stringEquals("name", "de"), "name prefix");
+
+  // The output matches the runtime encoder
+  uint8_t buf[128];
+  const int16_t table[] = {1, -2, 300};
+  MicroCbor cbor(buf, sizeof(buf));
+  cbor.startMap(5);
+  cbor.add("rate", int32_t(100));
+  cbor.add("offset", int8_t(-3));
+  cbor.add("on", true);
+  cbor.add("name", "dev");
+  cbor.startMap("sub", 1);
+  cbor.add("table", table, 3, false);
+  cbor.endMap();
+  cbor.endMap();
+  ASSERT_EQ(cbor.bytesSerialized(), kConfig.size());
+  ASSERT_EQ(0, memcmp(buf, kConfig.data(), kConfig.size()));
+
+  MicroCbor reader(kConfig.data(), kConfig.size());
+  int16_t copy[3];
+  auto t = reader.getMap("sub").getPointerChecked<int16_t>("table", nullptr,
+                                                           copy, 3);
+  ASSERT_EQ(3u, t.length);
+  ASSERT_EQ(300, t.p[2]);
+
+#if __cplusplus >= 201703L
+  constexpr auto kBlob = kConfig.toArray<kConfig.size()>();
+  static_assert(kBlob.size() == kConfig.size(), "size");
+  ASSERT_EQ(0, memcmp(kBlob.data(), buf, kBlob.size()));
+#endif
+
+  // Wrong counts are reported
+  constexpr auto kBad = MicroCborConst<8>().startMap(2).add("a", 1).endMap();
+  static_assert(kBad.getResult() == kCborErrorState, "count");
+
+  // Unnamed containers count as items of their parent
+  constexpr auto kNested = MicroCborConst<32>()
+                               .startArray(3)
+                               .add(nullptr, 1)
+                               .startArray(1)
+                               .add(nullptr, 2)
+                               .endArray()
+                               .add(nullptr, 3)
+                               .endArray();
+  static_assert(kNested.getResult() == kCborOk, "array of arrays");
+  constexpr auto kRecords = MicroCborConst<32>()
+                                .startMap(1)
+                                .startArray("a", 2)
+                                .startMap(1)
+                                .add("x", 1)
+                                .endMap()
+                                .startMap(1)
+                                .add("x", 2)
+                                .endMap()
+                                .endArray()
+                                .endMap();
+  static_assert(kRecords.getResult() == kCborOk, "array of maps");
+  constexpr auto kExtra =
+      MicroCborConst<16>().startArray(1).startMap(0).endMap().startMap(0);
+  static_assert(kExtra.getResult() == kCborErrorState, "extra item");
+  MicroCbor records(kRecords.data(), kRecords.size());
+  ASSERT_EQ(2, records.getArray("a").at(1).get("x", 0));
+}
+#endif
+
 int main(int argc, char **argv) {
   // debug arguments such as pause --gtest_filter=microcbor.basic*
   bool pauseOnExit = argc > 1 && std::string(argv[1]) == "pause";
@@ -0,0 +1,492 @@
+/*********************************************************************************
+ * SPDX-License-Identifier: MIT
+ *
+ * @brief Convert a JSON or CBOR file to a C++ source holding the CBOR in a
+ * const uint8_t array and a MicroCborIndex over its top-level keys.
+ *
+ * Usage: MicroCborEmbed <input.json|input.cbor> <output.cpp> <output.h> <name>
+ *
+ * JSON arrays of numbers are stored as aligned typed arrays so they can be
+ * read in place with getPointer().  Integers use the narrowest of int32_t
+ * and int64_t holding every element, arrays with any fraction or exponent
+ * use double.  Other JSON values map to their CBOR counterparts.  CBOR input
+ * is embedded as is and must hold a map.
+ *
+ * Normally run by microcbor_embed() in cmake/MicroCborEmbed.cmake.
+ ********************************************************************************/
+#include <microcbor/MicroCbor.hpp>
+
+#include <stdio.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace entazza;
+
+namespace {
+
+struct JsonValue {
+  enum Type { kNull, kBool, kInt, kFloat, kString, kArray, kObject };
+  Type type = kNull;
+  bool b = false;
+  int64_t i = 0;
+  double f = 0;
+  std::string s;
+  std::vector<JsonValue> items;
+  std::vector<std::pair<std::string, JsonValue>> members;
+};
+
+class JsonParser {
+ public:
+  explicit JsonParser(const std::string &text) : mText(text) {}
+
+  bool parse(JsonValue &value) {
+    if (!parseValue(value, 0)) {
+      return false;
+    }
+    skipSpace();
+    return mPos == mText.size() || fail("trailing characters");
+  }
+
+  const std::string &error() const { return mError; }
+
+ private:
+  static constexpr int kMaxDepth = CONFIG_MICROCBOR_MAX_NESTING;
+  const std::string &mText;
+  size_t mPos = 0;
+  std::string mError;
+
+  bool fail(const char *what) {
+    if (mError.empty()) {
+      mError = std::string(what) + " at offset " + std::to_string(mPos);
+    }
+    return false;
+  }
+
+  void skipSpace() {
+    while (mPos < mText.size() && strchr(" \t\r\n", mText[mPos]) != nullptr &&
+           mText[mPos] != 0) {
+      mPos++;
+    }
+  }
+
+  bool consume(const char *token) {
+    const size_t len = strlen(token);
+    if (mText.compare(mPos, len, token) != 0) {
+      return false;
+    }
+    mPos += len;
+    return true;
+  }
+
+  bool parseValue(JsonValue &value, const int depth) {
+    skipSpace();
+    if (mPos >= mText.size()) {
+      return fail("unexpected end");
+    }
+    const char c = mText[mPos];
+    if (c == '{' || c == '[') {
+      if (depth >= kMaxDepth) {
+        return fail("nesting too deep");
+      }
+      return c == '{' ? parseObject(value, depth) : parseArray(value, depth);
+    }
+    if (c == '"') {
+      value.type = JsonValue::kString;
+      return parseString(value.s);
+    }
+    if (consume("true") || consume("false")) {
+      value.type = JsonValue::kBool;
+      value.b = c == 't';
+      return true;
+    }
+    if (consume("null")) {
+      value.type = JsonValue::kNull;
+      return true;
+    }
+    return parseNumber(value);
+  }
+
+  bool parseObject(JsonValue &value, const int depth) {
+    value.type = JsonValue::kObject;
+    mPos++;
+    skipSpace();
+    if (consume("}")) {
+      return true;
+    }
+    for (;;) {
+      skipSpace();
+      std::string name;
+      if (mPos >= mText.size() || mText[mPos] != '"') {
+        return fail("expected key");
+      }
+      if (!parseString(name)) {
+        return false;
+      }
+      skipSpace();
+      if (!consume(":")) {
+        return fail("expected ':'");
+      }
+      value.members.emplace_back(std::move(name), JsonValue());
+      if (!parseValue(value.members.back().second, depth + 1)) {
+        return false;
+      }
+      skipSpace();
+      if (consume("}")) {
+        return true;
+      }
+      if (!consume(",")) {
+        return fail("expected ',' or '}'");
+      }
+    }
+  }
+
+  bool parseArray(JsonValue &value, const int depth) {
+    value.type = JsonValue::kArray;
+    mPos++;
+    skipSpace();
+    if (consume("]")) {
+      return true;
+    }
+    for (;;) {
+      value.items.emplace_back();
+      if (!parseValue(value.items.back(), depth + 1)) {
+        return false;
+      }
+      skipSpace();
+      if (consume("]")) {
+        return true;
+      }
+      if (!consume(",")) {
+        return fail("expected ',' or ']'");
+      }
+    }
+  }
+
+  bool parseHex4(uint32_t &cp) {
+    if (mPos + 4 > mText.size()) {
+      return fail("bad escape");
+    }
+    cp = 0;
+    for (int k = 0; k < 4; k++) {
+      const char h = mText[mPos++];
+      cp <<= 4;
+      if (h >= '0' && h <= '9') {
+        cp |= h - '0';
+      } else if (h >= 'a' && h <= 'f') {
+        cp |= h - 'a' + 10;
+      } else if (h >= 'A' && h <= 'F') {
+        cp |= h - 'A' + 10;
+      } else {
+        return fail("bad escape");
+      }
+    }
+    return true;
+  }
+
+  static void appendUtf8(std::string &out, const uint32_t cp) {
+    if (cp < 0x80) {
+      out += char(cp);
+    } else if (cp < 0x800) {
+      out += char(0xc0 | cp >> 6);
+      out += char(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+      out += char(0xe0 | cp >> 12);
+      out += char(0x80 | (cp >> 6 & 0x3f));
+      out += char(0x80 | (cp & 0x3f));
+    } else {
+      out += char(0xf0 | cp >> 18);
+      out += char(0x80 | (cp >> 12 & 0x3f));
+      out += char(0x80 | (cp >> 6 & 0x3f));
+      out += char(0x80 | (cp & 0x3f));
+    }
+  }
+
+  bool parseString(std::string &out) {
+    mPos++;  // opening quote
+    while (mPos < mText.size()) {
+      const char c = mText[mPos++];
+      if (c == '"') {
+        return true;
+      }
+      if (c != '\\') {
+        out += c;
+        continue;
+      }
+      if (mPos >= mText.size()) {
+        break;
+      }
+      const char e = mText[mPos++];
+      switch (e) {
+        case '"':
+        case '\\':
+        case '/':
+          out += e;
+          break;
+        case 'b':
+          out += '\b';
+          break;
+        case 'f':
+          out += '\f';
+          break;
+        case 'n':
+          out += '\n';
+          break;
+        case 'r':
+          out += '\r';
+          break;
+        case 't':
+          out += '\t';
+          break;
+        case 'u': {
+          uint32_t cp;
+          if (!parseHex4(cp)) {
+            return false;
+          }
+          if (cp >= 0xd800 && cp < 0xdc00) {
+            uint32_t low;
+            if (!consume("\\u") || !parseHex4(low) || low < 0xdc00 ||
+                low >= 0xe000) {
+              return fail("bad surrogate pair");
+            }
+            cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+          }
+          if (cp == 0) {
+            return fail("null characters are not supported");
+          }
+          appendUtf8(out, cp);
+          break;
+        }
+        default:
+          return fail("bad escape");
+      }
+    }
+    return fail("unterminated string");
+  }
+
+  bool parseNumber(JsonValue &value) {
+    const char *begin = mText.c_str() + mPos;
+    size_t len = strspn(begin, "+-0123456789.eE");
+    if (len == 0) {
+      return fail("unexpected character");
+    }
+    const std::string number(begin, len);
+    char *end;
+    if (number.find_first_of(".eE") == std::string::npos) {
+      errno = 0;
+      value.type = JsonValue::kInt;
+      value.i = strtoll(number.c_str(), &end, 10);
+      if (errno != 0) {
+        // out of int64_t range
+        value.type = JsonValue::kFloat;
+        value.f = strtod(number.c_str(), &end);
+      }
+    } else {
+      value.type = JsonValue::kFloat;
+      value.f = strtod(number.c_str(), &end);
+    }
+    if (end != number.c_str() + len) {
+      return fail("bad number");
+    }
+    mPos += len;
+    return true;
+  }
+};
+
+template <typename T>
+void addNumbers(MicroCbor &cbor, const char *name,
+                const std::vector<JsonValue> &items) {
+  std::vector<T> values;
+  values.reserve(items.size());
+  for (const auto &item : items) {
+    values.push_back(item.type == JsonValue::kInt ? T(item.i) : T(item.f));
+  }
+  cbor.add(name, values.data(), uint32_t(values.size()));
+}
+
+void encode(MicroCbor &cbor, const char *name, const JsonValue &value) {
+  switch (value.type) {
+    case JsonValue::kNull:
+      cbor.add(name, std::optional<int32_t>(), true);
+      break;
+    case JsonValue::kBool:
+      cbor.add(name, value.b);
+      break;
+    case JsonValue::kInt:
+      if (value.i == int32_t(value.i)) {
+        cbor.add(name, int32_t(value.i));
+      } else {
+        cbor.add(name, value.i);
+      }
+      break;
+    case JsonValue::kFloat:
+      cbor.add(name, value.f);
+      break;
+    case JsonValue::kString:
+      cbor.add(name, value.s.c_str());
+      break;
+    case JsonValue::kObject:
+      // The count sets the header width up front, widening it later would
+      // shift the aligned typed arrays inside.
+      if (name == nullptr) {
+        cbor.startMap(uint32_t(value.members.size()));
+      } else {
+        cbor.startMap(name, uint32_t(value.members.size()));
+      }
+      for (const auto &member : value.members) {
+        encode(cbor, member.first.c_str(), member.second);
+      }
+      cbor.endMap();
+      break;
+    case JsonValue::kArray: {
+      bool numbers = !value.items.empty();
+      bool floats = false;
+      bool wide = false;
+      for (const auto &item : value.items) {
+        numbers &=
+            item.type == JsonValue::kInt || item.type == JsonValue::kFloat;
+        floats |= item.type == JsonValue::kFloat;
+        wide |= item.type == JsonValue::kInt && item.i != int32_t(item.i);
+      }
+      if (numbers && floats) {
+        addNumbers<double>(cbor, name, value.items);
+      } else if (numbers && wide) {
+        addNumbers<int64_t>(cbor, name, value.items);
+      } else if (numbers) {
+        addNumbers<int32_t>(cbor, name, value.items);
+      } else {
+        cbor.startArray(name, uint32_t(value.items.size()));
+        for (const auto &item : value.items) {
+          encode(cbor, nullptr, item);
+        }
+        cbor.endArray();
+      }
+      break;
+    }
+  }
+}
+
+bool readFile(const char *path, std::string &out) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  std::ostringstream ss;
+  ss << in.rdbuf();
+  out = ss.str();
+  return true;
+}
+
+void writeWords(std::ostream &out, const std::vector<uint32_t> &words) {
+  for (size_t i = 0; i < words.size(); i++) {
+    out << (i % 8 == 0 ? "\n    " : " ") << words[i] << "u,";
+  }
+  out << "\n";
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc != 5) {
+    fprintf(stderr,
+            "usage: %s <input.json|input.cbor> <output.cpp> <output.h> "
+            "<name>\n",
+            argv[0]);
+    return 2;
+  }
+  const char *input = argv[1];
+  const std::string name = argv[4];
+
+  std::string text;
+  if (!readFile(input, text)) {
+    fprintf(stderr, "%s: cannot read\n", input);
+    return 1;
+  }
+  std::vector<uint8_t> blob;
+  const size_t extension = std::string(input).rfind(".json");
+  if (extension != std::string::npos &&
+      extension + 5 == std::string(input).size()) {
+    JsonValue root;
+    JsonParser parser(text);
+    if (!parser.parse(root)) {
+      fprintf(stderr, "%s: %s\n", input, parser.error().c_str());
+      return 1;
+    }
+    if (root.type != JsonValue::kObject) {
+      fprintf(stderr, "%s: the top level must be an object\n", input);
+      return 1;
+    }
+    blob.resize(text.size() * 2 + 64);
+    for (;;) {
+      MicroCbor cbor(blob.data(), uint32_t(blob.size()));
+      encode(cbor, nullptr, root);
+      if (cbor.getResult() == kCborOk) {
+        blob.resize(cbor.bytesSerialized());
+        break;
+      }
+      if (cbor.getResult() != kCborErrorBufferFull || blob.size() > 1u << 30) {
+        fprintf(stderr, "%s: encoding failed %d\n", input, cbor.getResult());
+        return 1;
+      }
+      blob.resize(blob.size() * 2);
+    }
+  } else {
+    blob.assign(text.begin(), text.end());
+  }
+
+  std::vector<uint32_t> seeds;
+  std::vector<uint32_t> slots;
+  const auto result =
+      MicroCborIndex::build(blob.data(), uint32_t(blob.size()), seeds, slots);
+  if (result != kCborOk) {
+    fprintf(stderr, "%s: %s\n", input,
+            result == kCborErrorUnsupported ? "duplicate keys"
+                                            : "not a CBOR map");
+    return 1;
+  }
+
+  std::string file = input;
+  file = file.substr(file.find_last_of("/\\") + 1);
+  std::string header = argv[3];
+  header = header.substr(header.find_last_of("/\\") + 1);
+  std::ofstream source(argv[2]);
+  source << "// Generated by MicroCborEmbed from " << file
+         << ", do not edit.\n"
+         << "#include \"" << header << "\"\n\n"
+         << "alignas(64) const uint8_t " << name << "[" << blob.size()
+         << "] = {";
+  char hex[8];
+  for (size_t i = 0; i < blob.size(); i++) {
+    snprintf(hex, sizeof(hex), "0x%02x,", blob[i]);
+    source << (i % 12 == 0 ? "\n    " : " ") << hex;
+  }
+  source << "\n};\n\nstatic const uint32_t " << name << "Seeds[] = {";
+  writeWords(source, seeds);
+  source << "};\n\nstatic const uint32_t " << name << "Slots[] = {";
+  writeWords(source, slots);
+  source << "};\n\nconst entazza::MicroCborIndex " << name << "Index = {\n    "
+         << name << ", " << blob.size() << "u, " << name << "Seeds, "
+         << seeds.size() << "u, " << name << "Slots, " << slots.size()
+         << "u};\n";
+
+  std::ofstream declarations(argv[3]);
+  declarations << "// Generated by MicroCborEmbed from " << file
+               << ", do not edit.\n"
+               << "#pragma once\n\n"
+               << "#include <microcbor/MicroCbor.hpp>\n\n"
+               << "extern const uint8_t " << name << "[" << blob.size()
+               << "];\n"
+               << "extern const entazza::MicroCborIndex " << name
+               << "Index;\n";
+  if (!source || !declarations) {
+    fprintf(stderr, "%s: cannot write output\n", name.c_str());
+    return 1;
+  }
+  return 0;
+}